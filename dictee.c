@@ -1,15 +1,31 @@
 #include "editor.h"
 
 int main(int argc, char *argv[]) {
+  if (argc >= 3 && !strcmp(argv[1], "--bench-highlight")) {
+    int threads = argc >= 4 ? atoi(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+    editor_bench_highlight(argv[2], threads);
+    return 0;
+  }
+
   editor_init();
 
-  if (argc >= 2) {
-    editor_open_file(argv[1]);
+  if (argc >= 3 && !strcmp(argv[1], "--follow")) {
+    editor_open_file(argv[2]);
+    editor_follow_toggle();
+  } else if (argc >= 2) {
+    // a buffer each, the first file is shown
+    for (int i = 1; i < argc; i++)
+      editor_open_file(argv[i]);
+    if (argc > 2)
+      editor_next_buffer(1);
   }
 
   while (1) {
     editor_refresh_screen();
-    editor_process_keypress();
+    // every key already typed is handled before the next frame
+    do {
+      editor_process_keypress();
+    } while (editor_input_pending());
   }
 
   editor_exit();
@@ -1,47 +1,29 @@
 #include "editor.h"
 
+#include <limits.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static editor_config ec = {0};
 
 // save cursor pos
 static editor_cursor_position ecp = {0};
 
-char *C_HL_extensions[] = {".c", ".h", ".cpp", ".hpp", NULL};
-char *C_HL_keywords[] = {
-    "switch",  "if",    "while",    "for",     "break",   "continue",
-    "return",  "else",  "struct",   "union",   "typedef", "static",
-    "enum",    "class", "#include", "#define", "#endif",  "#if",
-    "#else",   "#elif", "#idef",    "#ifndef", "case",    "default",
-    "int|",    "long|", "double|",  "float|",  "char|",   "unsigned|",
-    "signed|", "void|", NULL};
-
-char *JS_HL_extensions[] = {".js", ".jsx", ".cjs", ".mjs", NULL};
-char *JS_HL_keywords[] = {"switch",   "if",      "while",   "for",     "break",
-                          "continue", "return",  "default", "import",  "export",
-                          "require",  "console", "else",    "static",  "const|",
-                          "class",    "case",    "let|",    "String|", "Array|",
-                          "Set|",     "Buffer|", NULL};
-
-editor_syntax HLDB[] = {
-    {"c", C_HL_extensions, "//", "/*", "*/", C_HL_keywords,
-     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_HIGHLIGHT_COMMENT},
-    {"js", JS_HL_extensions, "//", "/*", "*/", JS_HL_keywords,
-     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_HIGHLIGHT_COMMENT},
-};
-
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
-
 void editor_save_cursor_position() {
-  ecp.cx = ec.cx;
-  ecp.cy = ec.cy;
-  ecp.colOffset = ec.colOffset;
-  ecp.rowOffset = ec.rowOffset;
+  ecp.cx = ec.win->cx;
+  ecp.cy = ec.win->cy;
+  ecp.colOffset = ec.win->colOffset;
+  ecp.rowOffset = ec.win->rowOffset;
 }
 
 void editor_restore_cursor_position() {
-  ec.cx = ecp.cx;
-  ec.cy = ecp.cy;
-  ec.colOffset = ecp.colOffset;
-  ec.rowOffset = ecp.rowOffset;
+  ec.win->cx = ecp.cx;
+  ec.win->cy = ecp.cy;
+  ec.win->colOffset = ecp.colOffset;
+  ec.win->rowOffset = ecp.rowOffset;
 }
 
 char *editor_prompt(char *prompt, void (*callback)(char *, int)) {
@@ -53,7 +35,8 @@ char *editor_prompt(char *prompt, void (*callback)(char *, int)) {
 
   while (1) {
     editor_set_status_msg(prompt, buf);
-    editor_refresh_screen();
+    if (!editor_input_pending())
+      editor_refresh_screen();
 
     int c = editor_read_key();
     if (c == ESC) {
@@ -66,6 +49,21 @@ char *editor_prompt(char *prompt, void (*callback)(char *, int)) {
       if (buflen > 0) {
         buf[--buflen] = '\0';
       }
+    } else if (c == PASTE) {
+      // the answer is one line, line breaks and control chars are dropped
+      size_t len;
+      char *text = editor_input_paste(&len);
+      if (buflen + len >= bufsize) {
+        bufsize = buflen + len + 1;
+        buf = realloc(buf, bufsize);
+      }
+      for (size_t i = 0; i < len; i++) {
+        unsigned char ch = text[i];
+        if (!iscntrl(ch) && ch < 128)
+          buf[buflen++] = ch;
+      }
+      buf[buflen] = '\0';
+      free(text);
     } else if ((!iscntrl(c) && c < 128) || c == '\r') {
       if (c == '\r') {
         editor_set_status_msg("");
@@ -98,77 +96,85 @@ int editor_confirm() {
   return result;
 }
 
-void editor_search_prompt_callback(char *query, int c) {
-  // -1 if no match or index of last match
-  static int last_match = -1;
-  // search direction  1 forward | -1 backward
-  static int direction = 1;
+static void editor_search_jump(editor_match *m) {
+  ec.win->cy = m->row;
+  ec.win->cx = m->at;
+  // if top of file
+  // scroll bottom so result will be top of screen
+  // else offset cursor by half screen
+  ec.win->rowOffset =
+      ec.win->cy < ec.win->rows ? 0 : ec.win->cy - ec.win->rows / 2;
+}
 
-  static int saved_hl_line;
-  static char *saved_hl = NULL;
+void editor_search_prompt_callback(char *query, int c) {
+  // toggled with Ctrl-T and Ctrl-R, kept for the next searches
+  static int ignore_case = 0;
+  static int regex = 0;
+  // query the match index was started with, NULL once the search is over
+  static char *searched = NULL;
 
-  if (saved_hl != NULL) {
-    memcpy(ec.row[saved_hl_line].hl, saved_hl, ec.row[saved_hl_line].rsize);
-    free(saved_hl);
-    saved_hl = NULL;
-  }
+  int k, n, done;
+  editor_match m;
+  int shown = editor_match_index_status(&k, &n, &done) && k > 0;
 
   switch (c) {
   case '\r':
+    // the first match may not have come in yet
+    if (!shown && editor_match_index_step(1, &m))
+      editor_search_jump(&m);
+    editor_match_index_clear();
+    free(searched);
+    searched = NULL;
+    return;
   case ESC:
-    last_match = -1;
-    direction = 1;
+    editor_match_index_clear();
+    free(searched);
+    searched = NULL;
     return;
-    break;
   case MOVE_CURSOR_DOWN:
   case MOVE_CURSOR_RIGHT:
-    direction = 1;
-    break;
   case MOVE_CURSOR_UP:
-  case MOVE_CURSOR_LEFT:
-    direction = -1;
+  case MOVE_CURSOR_LEFT: {
+    int direction =
+        (c == MOVE_CURSOR_DOWN || c == MOVE_CURSOR_RIGHT) ? 1 : -1;
+    // step from the first match even if it is not shown yet
+    if (!shown && !editor_match_index_step(1, &m))
+      return;
+    if (editor_match_index_step(direction, &m))
+      editor_search_jump(&m);
+    return;
+  }
+  case REDRAW:
+    return;
+  case SEARCH_PROGRESS:
+    // only the first match moves the cursor, later ones update the count
+    if (!shown && n > 0 && editor_match_index_step(1, &m))
+      editor_search_jump(&m);
+    return;
+  case CTRL_KEY('t'):
+    ignore_case = !ignore_case;
+    break;
+  case CTRL_KEY('r'):
+    regex = !regex;
     break;
   default:
-    last_match = -1;
-    direction = 1;
-  }
-
-  if (last_match == -1)
-    direction = 1;
-
-  int current = last_match;
-
-  for (int i = 0; i < ec.numRows; i++) {
-    current += direction;
-    if (current == -1)
-      current = ec.numRows - 1;
-    else if (current == ec.numRows)
-      current = 0;
-
-    editor_row *row = &ec.row[current];
-    char *match = strstr(row->render, query);
-    if (match) {
-      last_match = ec.cy = current;
-      int rx = match - row->render;
-      ec.cx = editor_row_rx_to_cx(row, rx);
-      // if top of file
-      // scroll bottom so result will be top of screen
-      // else offset cursor by half screen
-      ec.rowOffset = ec.cy < ec.screenRows ? 0 : ec.cy - ec.screenRows / 2;
-
-      saved_hl_line = current;
-      saved_hl = malloc(row->rsize);
-      memcpy(saved_hl, row->hl, row->rsize);
-
-      memset(&row->hl[rx], HL_SEARCH_RESULT, str_len(query));
-      break;
-    }
+    // keys that leave the query as it is keep the matches and the position
+    if (searched != NULL && !strcmp(searched, query))
+      return;
   }
+
+  free(searched);
+  searched = strdup(query);
+  editor_match_index_start(query, ignore_case, regex, &ec.buf->store,
+                           ec.buf->rows, ec.buf->numRows);
 }
+
 void editor_find() {
   editor_save_cursor_position();
-  char *query = editor_prompt("Search: %s (ESC to cancel/Arrows to navigate)",
-                              editor_search_prompt_callback);
+  char *query = editor_prompt(
+      "Search: %s (ESC to cancel/Arrows to navigate/Ctrl-T to ignore "
+      "case/Ctrl-R for regex)",
+      editor_search_prompt_callback);
   if (query) {
     free(query);
   } else {
@@ -176,24 +182,64 @@ void editor_find() {
   }
 }
 
-int editor_save_file(const char *filename, char *buffer, long len) {
-  int fd = open(filename, O_RDWR | O_CREAT, 0644);
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buffer, len) == len) {
-        close(fd);
-        editor_set_status_msg("Saved file: %d bytes writen to \"%s\"", len,
-                              filename);
-        return len;
-      }
-    }
-    close(fd);
-  }
+static double editor_now();
+
+// buffer being saved, its dirty and the time when the save took its snapshot
+static editor_buffer *editor_saving_buffer;
+static int editor_saving_dirty;
+static double editor_saving_start;
 
+// wait for the save running, if any, and tell how it went
+static void editor_save_done() {
+  if (!editor_save_running())
+    return;
+  editor_buffer *b = editor_saving_buffer;
+  long len = editor_save_finish();
+  if (len == -1) {
+    editor_set_status_msg(
+        "Error: I/O error while saving using editor_save_file(): %s",
+        strerror(errno));
+    return;
+  }
+  // edits made during the save are not in the file
+  b->dirty = IMAX(0, b->dirty - editor_saving_dirty);
+  b->file_size = len;
+  // the save replaced the file being followed
+  if (b->follow != NULL) {
+    editor_follow_stop(b->follow);
+    b->follow = editor_follow_start(b->filename, len);
+  }
+  double elapsed = editor_now() - editor_saving_start;
+  if (elapsed <= 0)
+    elapsed = 1e-6;
   editor_set_status_msg(
-      "Error: I/O error while saving using editor_save_file(): %s",
-      strerror(errno));
-  return 0;
+      "Saved file: %ld bytes writen to \"%s\" in %.0f ms (%.1f MB/s)", len,
+      b->filename, elapsed * 1000, len / elapsed / (1024 * 1024));
+}
+
+// show how far the save got until it is done
+static void editor_save_tick() {
+  size_t written, total;
+  if (!editor_save_running())
+    return;
+  if (!editor_save_progress(&written, &total)) {
+    editor_save_done();
+    return;
+  }
+  editor_set_status_msg("Saving \"%s\": %d%%", editor_saving_buffer->filename,
+                        total > 0 ? (int)(written * 100 / total) : 0);
+  editor_loop_timer(SAVE_PROGRESS_MS, editor_save_tick);
+}
+
+// Save the buffer to filename in the background, editing goes on meanwhile.
+// A save still running is waited for first.
+void editor_save_file(const char *filename) {
+  editor_save_done();
+  editor_saving_buffer = ec.buf;
+  editor_saving_dirty = ec.buf->dirty;
+  editor_saving_start = editor_now();
+  editor_save_start(filename, &ec.buf->store, editor_row_at(0));
+  editor_loop_timer(SAVE_PROGRESS_MS, editor_save_tick);
 }
 
 void editor_open() {
@@ -204,271 +250,621 @@ void editor_open() {
   }
 }
 void editor_save() {
-  if (ec.filename == NULL) {
-    ec.filename = editor_prompt("Save as: %s (ESC to cancel)", NULL);
-    if (ec.filename == NULL || editor_confirm() != 1) {
-      ec.filename = NULL;
+  if (ec.buf->filename == NULL) {
+    // named only once confirmed, autosave skips unnamed files
+    char *filename = editor_prompt("Save as: %s (ESC to cancel)", NULL);
+    if (filename == NULL || editor_confirm() != 1) {
+      free(filename);
       editor_set_status_msg("Save file aborted");
       return;
     }
+    ec.buf->filename = filename;
     editor_select_filetype_syntax();
   }
-  size_t len;
-  char *buf = editor_rows_to_string(&len);
-
-  if (editor_save_file(ec.filename, buf, len) > 0) {
-    ec.dirty = 0;
-  }
-
-  free(buf);
-}
-
-char *editor_rows_to_string(size_t *buflen) {
-  size_t len = 0;
-  int j;
-
-  for (j = 0; j < ec.numRows; j++) {
-    len += ec.row[j].size + 1;
-  }
-
-  *buflen = len;
-
-  char *buf = malloc(len);
-  char *p = buf;
-
-  for (j = 0; j < ec.numRows; j++) {
-    memcpy(p, ec.row[j].chars, ec.row[j].size);
-    p += ec.row[j].size;
-    *p = '\n';
-    p++;
-  }
-
-  return buf;
+  editor_save_file(ec.buf->filename);
 }
 
 void editor_row_insert_char(editor_row *row, int at, int c) {
   if (at < 0 || at > row->size)
     at = row->size;
-  row->chars = realloc(row->chars, row->size + 2);
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  editor_row_materialize(row);
+  editor_text_store_reserve(&ec.buf->store, row, 1);
+  editor_row_move_gap(row, at);
+  row->chars[row->gap_at++] = c;
+  row->gap_len--;
   row->size++;
-  row->chars[at] = c;
-  editor_update_row(row);
-  ec.dirty++;
+  editor_update_row_span(row, at, NULL, 0, 1);
+  ec.buf->dirty++;
 }
 
 void editor_insert_char(int c) {
-  if (ec.cy == ec.numRows) {
-    editor_insert_row(ec.numRows, "", 0);
+  if (ec.win->cy == ec.buf->numRows) {
+    editor_insert_row(ec.buf->numRows, "", 0);
   }
   // insert new line
   if (c == '\r' || c == '\n') {
-    if (ec.cx == 0) {
-      editor_insert_row(ec.cy, "", 0);
+    if (ec.win->cx == 0) {
+      editor_insert_row(ec.win->cy, "", 0);
     } else {
-      editor_row *row = &ec.row[ec.cy];
-      editor_insert_row(ec.cy + 1, &row->chars[ec.cx], row->size - ec.cx);
-      row = &ec.row[ec.cy];
-      row->size = ec.cx;
-      row->chars[row->size] = '\0';
-      editor_update_row(row);
+      editor_row *row = editor_row_at(ec.win->cy);
+      editor_text_store_thaw(&ec.buf->store, row);
+      editor_row_move_gap(row, ec.win->cx);
+      editor_insert_row(ec.win->cy + 1, &row->chars[ec.win->cx + row->gap_len],
+                        row->size - ec.win->cx);
+      row = editor_row_at(ec.win->cy);
+      editor_row *next = editor_row_at(ec.win->cy + 1);
+      editor_row_materialize(row);
+      editor_text_store_truncate(&ec.buf->store, row, ec.win->cx);
+      editor_update_row_span(row, ec.win->cx, next->chars, next->size, 0);
     }
-    ec.cy++;
-    ec.cx = 0;
+    ec.win->cy++;
+    ec.win->cx = 0;
   } else {
-    int len = ec.row[ec.cy].rsize;
-    editor_row_insert_char(&ec.row[ec.cy], ec.cx, c);
-    int offset = ec.row[ec.cy].rsize - len;
-    ec.cx += offset >= 0 ? offset : 0;
+    editor_row_insert_char(editor_row_at(ec.win->cy), ec.win->cx, c);
+    ec.win->cx++;
   }
 }
 
 void editor_row_delete_char(editor_row *row, int at) {
-  if (row == NULL || at < 0 || at > row->size)
+  if (row == NULL || at < 0 || at >= row->size)
     return;
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-  row->chars[row->size] = '\0';
+  char removed = editor_row_char(row, at);
+  editor_row_materialize(row);
+  editor_text_store_reserve(&ec.buf->store, row, 0);
+  editor_row_move_gap(row, at + 1);
+  row->gap_at--;
+  row->gap_len++;
   row->size--;
-  editor_update_row(row);
-  ec.dirty++;
+  editor_update_row_span(row, at, &removed, 1, 0);
+  ec.buf->dirty++;
 }
 
+static int editor_row_prev_char(editor_row *row, int at, int over);
+
 void editor_delete_char() {
-  if (ec.cx == 0 && ec.cy == 0)
+  if (ec.win->cx == 0 && ec.win->cy == 0)
     return;
 
-  editor_row *row = &ec.row[ec.cy];
-  if (ec.cx > 0) {
-    editor_row_delete_char(row, ec.cx - 1);
-    ec.cx--;
+  editor_row *row = editor_row_at(ec.win->cy);
+  if (ec.win->cx > 0) {
+    // the whole character, its combining marks stay
+    int start = editor_row_prev_char(row, ec.win->cx, 0);
+    while (ec.win->cx > start) {
+      editor_row_delete_char(row, ec.win->cx - 1);
+      ec.win->cx--;
+    }
   } else {
-    if (ec.cy >= ec.numRows) {
-      ec.cy = ec.numRows - 1;
-      editor_delete_row(ec.cy);
+    if (ec.win->cy >= ec.buf->numRows) {
+      ec.win->cy = ec.buf->numRows - 1;
+      editor_delete_row(ec.win->cy);
       return;
     }
-    ec.cx = ec.row[ec.cy - 1].size;
-    editor_row_append_string(&ec.row[ec.cy - 1], row->chars, row->size);
-    editor_delete_row(ec.cy);
-    ec.cy--;
+    editor_row *prev = editor_row_at(ec.win->cy - 1);
+    ec.win->cx = prev->size;
+    editor_text_store_thaw(&ec.buf->store, row);
+    editor_row_move_gap(row, row->size);
+    editor_row_append_string(prev, row->chars, row->size);
+    editor_delete_row(ec.win->cy);
+    ec.win->cy--;
   }
 }
 
-// cursor x to row x => support tab display in editor
-int editor_row_cx_to_rx(editor_row *row, int cx) {
-  int rx = 0;
-  int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t')
-      rx += (TAB_SIZE - 1) - (rx % TAB_SIZE);
-    rx++;
+// Column marks.
+// cx counts chars, the bytes of the row text, rx display columns and ri
+// bytes of the render, where tabs are spaces. A tab goes to the next tab
+// stop, a UTF-8 character takes the columns of its width. In a rendered row
+// of ASCII without tabs the three are the same. Other rows with a render and
+// more than COL_MARK_STEP chars keep a mark every COL_MARK_STEP chars, at the
+// first character starting there, added as lookups walk past them and cut
+// back when the row is edited. A lookup walks from the nearest mark, so it
+// reads COL_MARK_STEP chars at most however long the row is.
+
+// chars walked through at a time, copied out of the gap
+#define COL_WALK_CHUNK 4096
+
+// cx, rx and ri are the same all along row
+static int editor_row_plain(editor_row *row) {
+  editor_row_render *r = row->render;
+  return r != NULL && r->tabs == 0 && r->nonascii == 0;
+}
+
+// add the mark m is at to the marks of row
+static void editor_row_add_mark(editor_row *row, editor_col_mark *m) {
+  editor_row_render *r = row->render;
+  editor_col_marks *marks = r->marks;
+  if (marks->count == marks->cap) {
+    int cap = marks->cap * 2;
+    // scratch rows, in no block, are not part of the buffer
+    if (row->block != NULL)
+      ec.buf->render_bytes += sizeof(editor_col_mark) * (cap - marks->cap);
+    marks = realloc(marks, sizeof(editor_col_marks) +
+                               sizeof(editor_col_mark) * cap);
+    marks->cap = cap;
+    r->marks = marks;
   }
+  marks->at[marks->count++] = *m;
+}
 
-  return rx;
+// forget the marks that chars from at on may have moved, a character
+// starting up to 3 chars before at may end past it
+static void editor_row_cut_marks(editor_row *row, int at) {
+  editor_col_marks *marks = row->render->marks;
+  while (marks != NULL && marks->count > 1 &&
+         marks->at[marks->count - 1].cx > at - 4)
+    marks->count--;
 }
 
+static void editor_row_free_marks(editor_row *row) {
+  editor_row_render *r = row->render;
+  if (r == NULL || r->marks == NULL)
+    return;
+  if (row->block != NULL)
+    ec.buf->render_bytes -= sizeof(editor_col_marks) +
+                            sizeof(editor_col_mark) * r->marks->cap;
+  free(r->marks);
+  r->marks = NULL;
+}
+
+// the last mark at or before both char cx and column rx, the row start
+// when it keeps no marks
+static editor_col_mark editor_row_mark(editor_row *row, int cx, int rx) {
+  editor_row_render *r = row->render;
+  editor_col_mark start = {0, 0, 0};
+  if (r == NULL || row->size <= COL_MARK_STEP)
+    return start;
+  if (r->marks == NULL) {
+    int cap = 16;
+    r->marks =
+        malloc(sizeof(editor_col_marks) + sizeof(editor_col_mark) * cap);
+    r->marks->count = 1;
+    r->marks->cap = cap;
+    r->marks->at[0] = start;
+    if (row->block != NULL)
+      ec.buf->render_bytes +=
+          sizeof(editor_col_marks) + sizeof(editor_col_mark) * cap;
+  }
+  editor_col_marks *marks = r->marks;
+  int lo = 0, hi = marks->count;
+  while (hi - lo > 1) {
+    int mid = lo + (hi - lo) / 2;
+    if (marks->at[mid].cx <= cx && marks->at[mid].rx <= rx)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return marks->at[lo];
+}
+
+// Move m over the characters of row that end by char to and start left of
+// column rx. Marks m passes by are added to the row.
+static void editor_row_walk(editor_row *row, editor_col_mark *m, int to,
+                            int rx) {
+  editor_row_render *r = row->render;
+  char buf[COL_WALK_CHUNK + 3];
+  while (m->cx < to) {
+    // a character at the end of the chunk is read whole
+    int len = IMIN(COL_WALK_CHUNK, to - m->cx);
+    int avail = IMIN(len + 3, row->size - m->cx);
+    editor_row_copy(row, m->cx, m->cx + avail, buf);
+    int i = 0;
+    while (i < len) {
+      int next_mark = INT_MAX;
+      if (r->marks != NULL) {
+        next_mark = r->marks->count * COL_MARK_STEP;
+        if (m->cx >= next_mark) {
+          editor_row_add_mark(row, m);
+          next_mark += COL_MARK_STEP;
+        }
+      }
+
+      int n, width, rlen;
+      if (buf[i] == '\t') {
+        n = 1;
+        width = rlen = TAB_SIZE - m->rx % TAB_SIZE;
+      } else if ((unsigned char)buf[i] >= 0x80) {
+        int cp;
+        n = editor_utf8_decode(&buf[i], avail - i, &cp);
+        width = editor_utf8_width(cp);
+        rlen = n;
+      } else {
+        // a column a char up to the next mark or rx
+        n = editor_utf8_ascii(&buf[i], len - i);
+        n = IMIN(n, next_mark - m->cx);
+        n = IMIN(n, IMAX(rx - m->rx, 1));
+        width = rlen = n;
+      }
+      if (m->cx + n > to || m->rx + width > rx)
+        return;
+      m->cx += n;
+      m->rx += width;
+      m->ri += rlen;
+      i += n;
+    }
+  }
+}
+
+// column char cx of row is drawn at
+int editor_row_cx_to_rx(editor_row *row, int cx) {
+  if (editor_row_plain(row))
+    return cx;
+  editor_col_mark m = editor_row_mark(row, cx, INT_MAX);
+  editor_row_walk(row, &m, cx, INT_MAX);
+  return m.rx;
+}
+
+// offset in render of char cx of row, which may be inside a character
+// while it is typed a byte at a time
+static int editor_row_cx_to_ri(editor_row *row, int cx) {
+  if (editor_row_plain(row))
+    return cx;
+  editor_col_mark m = editor_row_mark(row, cx, INT_MAX);
+  editor_row_walk(row, &m, cx, INT_MAX);
+  // render holds the bytes of a character as they are
+  return m.ri + cx - m.cx;
+}
+
+// where the character of row drawn over column rx starts, or the row ends
+static editor_col_mark editor_row_col_at(editor_row *row, int rx) {
+  if (editor_row_plain(row)) {
+    int at = IMIN(rx, row->size);
+    editor_col_mark m = {at, at, at};
+    return m;
+  }
+  editor_col_mark m = editor_row_mark(row, INT_MAX, rx);
+  editor_row_walk(row, &m, row->size, rx);
+  return m;
+}
+
+// char of row drawn over column rx, the row size past its end
 int editor_row_rx_to_cx(editor_row *row, int rx) {
-  int currentrx = 0;
-  int cx;
-  for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t')
-      currentrx += (TAB_SIZE - 1) - (currentrx % TAB_SIZE);
-    currentrx++;
+  return editor_row_col_at(row, rx).cx;
+}
 
-    if (currentrx > rx)
-      return cx;
+// Start of the character before char at of row, over its combining marks
+// when over is set.
+static int editor_row_prev_char(editor_row *row, int at, int over) {
+  while (at > 0) {
+    at--;
+    int start = at;
+    // continuation bytes of a sequence starting at most 3 chars before
+    while (start > 0 && at - start < 3 &&
+           (editor_row_char(row, start) & 0xc0) == 0x80)
+      start--;
+    char buf[4];
+    int cp;
+    editor_row_copy(row, start, IMIN(start + 4, row->size), buf);
+    if (start + editor_utf8_decode(buf, IMIN(4, row->size - start), &cp) >
+        at)
+      at = start;
+    else
+      cp = -1;
+    if (!over || at == 0 || editor_utf8_width(cp) != 0)
+      break;
   }
+  return at;
+}
 
-  return cx;
+// end of the character of row starting at char at, with the combining marks
+// following it
+static int editor_row_next_char(editor_row *row, int at) {
+  char buf[4];
+  int cp;
+  do {
+    int len = IMIN(4, row->size - at);
+    editor_row_copy(row, at, at + len, buf);
+    at += editor_utf8_decode(buf, len, &cp);
+    if (at < row->size) {
+      len = IMIN(4, row->size - at);
+      editor_row_copy(row, at, at + len, buf);
+      editor_utf8_decode(buf, len, &cp);
+    }
+  } while (at < row->size && editor_utf8_width(cp) == 0);
+  return at;
 }
 
-void editor_row_update_syntax(editor_row *row) {
-  row->hl = realloc(row->hl, row->rsize);
-  memset(row->hl, HL_DEFAULT, row->rsize);
+// Highlight spans.
+// The highlight of a rendered row is kept as spans of bytes lexed as one
+// class, sorted by start and apart from each other. The bytes between them
+// are HL_DEFAULT, so plain text takes no room, and the spans of a row hold
+// what is drawn in one color.
 
-  if (ec.syntax == NULL)
+// make room for count spans in row
+static void editor_row_reserve_hl(editor_row *row, int count) {
+  editor_row_render *r = row->render;
+  if (count <= r->hl_cap)
     return;
+  int cap = r->hl_cap ? r->hl_cap : 2;
+  while (cap < count)
+    cap *= 2;
+  if (row->block != NULL)
+    ec.buf->render_bytes +=
+        sizeof(editor_hl_span) * (size_t)(cap - r->hl_cap);
+  r->hl = realloc(r->hl, sizeof(editor_hl_span) * cap);
+  r->hl_cap = cap;
+}
 
-  char **keywords = ec.syntax->keywords;
+// first of the count first spans of row ending after render byte at, count
+// when none does
+static int editor_row_hl_find(editor_row *row, int count, int at) {
+  editor_row_render *r = row->render;
+  int lo = 0, hi = count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (r->hl[mid].start + r->hl[mid].len <= at)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
 
-  char *slc_start = ec.syntax->single_line_comment_start;
-  char *mlc_start = ec.syntax->multiline_comment_start;
-  char *mlc_end = ec.syntax->multiline_comment_end;
+// class of render byte at in the count first spans of row
+static unsigned char editor_row_hl_at(editor_row *row, int count, int at) {
+  editor_row_render *r = row->render;
+  int j = editor_row_hl_find(row, count, at);
+  return j < count && r->hl[j].start <= at ? r->hl[j].hl : HL_DEFAULT;
+}
 
-  int slc_len = slc_start ? str_len(slc_start) : 0;
-  int mlcs_len = mlcs_len ? str_len(mlc_start) : 0;
-  int mlce_len = mlce_len ? str_len(mlc_end) : 0;
+// Lex render[from, to) as class hl. Spans go after the first ones of row,
+// a span carrying on from the last one lexed is merged with it.
+static void editor_row_add_hl(editor_row *row, int first, int from, int to,
+                              unsigned char hl) {
+  editor_row_render *r = row->render;
+  if (hl == HL_DEFAULT || from == to)
+    return;
+  if (r->hl_count > first) {
+    editor_hl_span *last = &r->hl[r->hl_count - 1];
+    if (last->hl == hl && last->start + last->len == from) {
+      last->len = to - last->start;
+      return;
+    }
+  }
+  editor_row_reserve_hl(row, r->hl_count + 1);
+  r->hl[r->hl_count++] = (editor_hl_span){from, to - from, hl};
+}
+
+// The spans past the first ones of row were lexed over render[start, stop),
+// they take the place of the first ones over it. The byte before start and
+// the one before stop are HL_DEFAULT, no span lies across either.
+static void editor_row_splice_hl(editor_row *row, int first, int start,
+                                 int stop) {
+  editor_row_render *r = row->render;
+  if (r->hl_count == 0)
+    return;
+  int before = editor_row_hl_find(row, first, start);
+  int after = editor_row_hl_find(row, first, stop);
+  int lexed = r->hl_count - first;
+  int tail = first - after;
+  editor_row_reserve_hl(row, r->hl_count + tail);
+  memcpy(&r->hl[r->hl_count], &r->hl[after],
+         sizeof(editor_hl_span) * tail);
+  memmove(&r->hl[before], &r->hl[first],
+          sizeof(editor_hl_span) * (lexed + tail));
+  r->hl_count = before + lexed + tail;
+}
+
+// render[from, old_end) became render[from, new_end): the spans after it
+// move with the bytes, the parts over it go until it is lexed again
+static void editor_row_shift_hl(editor_row *row, int from, int old_end,
+                                int new_end) {
+  editor_row_render *r = row->render;
+  int j = editor_row_hl_find(row, r->hl_count, from);
+  if (j < r->hl_count && r->hl[j].start < from &&
+      r->hl[j].start + r->hl[j].len > old_end) {
+    // a span across the whole change is cut in two around it
+    editor_row_reserve_hl(row, r->hl_count + 1);
+    memmove(&r->hl[j + 1], &r->hl[j],
+            sizeof(editor_hl_span) * (r->hl_count - j));
+    r->hl_count++;
+    r->hl[j].len = from - r->hl[j].start;
+    j++;
+    r->hl[j].len -= old_end - r->hl[j].start;
+    r->hl[j].start = old_end;
+  }
+
+  int n = j;
+  for (; j < r->hl_count; j++) {
+    editor_hl_span span = r->hl[j];
+    int end = span.start + span.len;
+    if (span.start < from) {
+      span.len = from - span.start;
+    } else if (end <= old_end) {
+      continue;
+    } else {
+      span.start = IMAX(span.start, old_end) + new_end - old_end;
+      span.len = end + new_end - old_end - span.start;
+    }
+    r->hl[n++] = span;
+  }
+  r->hl_count = n;
+}
+
+// Lex row->render from start, in_comment holds the multiline comment state
+// there and is updated with the state at the end of the row.
+// start must be a clean boundary: the row start or right after whitespace
+// lexed as HL_DEFAULT. Once past until, lexing stops at the first whitespace
+// that was HL_DEFAULT before and still is: the state there is clean again
+// so the rest of the old highlight still holds. Pass -1 to lex the whole row.
+// Returns 1 if it ran to the end of the row.
+static int editor_row_lex(editor_row *row, int start, int until,
+                          int *in_comment_state) {
+  editor_row_render *r = row->render;
+  editor_syntax *s = ec.buf->syntax;
+  if (s == NULL) {
+    return until < 0;
+  }
+
+  const unsigned char *classes = s->classes;
+  char *render = r->text;
+  int rsize = r->size;
+  // the old spans stay in front while the row is lexed, the new ones
+  // replace them once it converges or ends
+  int old = r->hl_count;
 
   int prev_sep = 1;
-  int in_string = 0;
-  int in_comment = (row->index > 0 && ec.row[row->index - 1].hl_open_comment);
-
-  int i = 0;
-  while (i < row->rsize) {
-    char c = row->render[i];
-    unsigned char prev_hl = i > 0 ? row->hl[i - 1] : HL_DEFAULT;
-
-    if (ec.syntax->flags & HL_HIGHLIGHT_COMMENT) {
-      // handle single line comment
-      if (slc_len && !in_string && !in_comment) {
-        if (!strncmp(&row->render[i], slc_start, slc_len)) {
-          memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-          break;
-        }
+  unsigned char prev_hl = HL_DEFAULT;
+  int in_comment = *in_comment_state;
+
+  int i = start;
+  while (i < rsize) {
+    if (in_comment) {
+      // the comment runs up to its end delimiter or the end of the row
+      char *end = memmem(&render[i], rsize - i, s->multiline_comment_end,
+                         s->mlce_len);
+      int stop = end ? end - render + s->mlce_len : rsize;
+      editor_row_add_hl(row, old, i, stop, HL_MLCOMMENT);
+      prev_hl = HL_MLCOMMENT;
+      i = stop;
+      if (end) {
+        in_comment = 0;
+        prev_sep = 1;
       }
+      continue;
+    }
 
-      // handle multi line comment
-      if (mlcs_len && mlce_len && !in_string) {
-        if (in_comment) {
-          row->hl[i] = HL_MLCOMMENT;
-          if (!strncmp(&row->render[i], mlc_end, mlce_len)) {
-            memset(&row->hl[i], HL_MLCOMMENT, mlce_len);
-            i += mlce_len;
-            in_comment = 0;
-            prev_sep = 1;
-            continue;
-          } else {
-            i++;
-            continue;
-          }
-        } else if (!strncmp(&row->render[i], mlc_start, mlcs_len)) {
-          memset(&row->hl[i], HL_MLCOMMENT, mlcs_len);
-          i += mlcs_len;
-          in_comment = 1;
-          continue;
-        }
+    char c = render[i];
+    unsigned char cls = classes[(unsigned char)c];
+
+    if (cls & CHAR_COMMENT) {
+      if (s->slc_len &&
+          !strncmp(&render[i], s->single_line_comment_start, s->slc_len)) {
+        editor_row_add_hl(row, old, i, rsize, HL_COMMENT);
+        break;
+      }
+      if (s->mlcs_len &&
+          !strncmp(&render[i], s->multiline_comment_start, s->mlcs_len)) {
+        editor_row_add_hl(row, old, i, i + s->mlcs_len, HL_MLCOMMENT);
+        prev_hl = HL_MLCOMMENT;
+        i += s->mlcs_len;
+        in_comment = 1;
+        continue;
       }
     }
 
-    // handle strings
-    if (ec.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-      if (in_string) {
-        row->hl[i] = HL_STRING;
-        if (c == '\\' && i + 1 < row->rsize) {
-          row->hl[i + 1] = HL_STRING;
-          i += 2;
-          continue;
-        }
-        if (c == in_string)
-          in_string = 0;
-        i++;
-        prev_sep = 1;
-        continue;
-      } else if (c == '"' || c == '\'') {
-        in_string = c;
-        row->hl[i] = HL_STRING;
-        i++;
-        continue;
+    if (cls & CHAR_QUOTE) {
+      // strings end with the row, an escape skips the next char
+      int end = i + 1;
+      while (end < rsize) {
+        char sc = render[end++];
+        if (sc == '\\' && end < rsize)
+          end++;
+        else if (sc == c)
+          break;
       }
+      editor_row_add_hl(row, old, i, end, HL_STRING);
+      prev_hl = HL_STRING;
+      i = end;
+      prev_sep = 1;
+      continue;
     }
 
-    // handle numbers
-    if (ec.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-      if (isdigit(c) && (prev_sep || prev_hl == HL_NUMBER) ||
+    if (s->flags & HL_HIGHLIGHT_NUMBERS) {
+      if (((cls & CHAR_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) ||
           (c == '.' && prev_hl == HL_NUMBER)) {
-        row->hl[i] = HL_NUMBER;
+        editor_row_add_hl(row, old, i, i + 1, HL_NUMBER);
+        prev_hl = HL_NUMBER;
         i++;
         prev_sep = 0;
         continue;
       }
     }
 
-    // handle keywords
-    if (prev_sep) {
-      int j;
-      for (j = 0; keywords[j]; j++) {
-        int len = str_len(keywords[j]);
-        // kw2 are the ones that ends with |
-        int kw2 = keywords[j][len - 1] == '|';
-        if (kw2)
-          len--;
-        if (!strncmp(&row->render[i], keywords[j], len) &&
-            c_is_separator(row->render[i + len])) {
-          memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, len);
-          i += len;
-          break;
-        }
-      }
-      if (keywords[j] != NULL) {
+    prev_hl = HL_DEFAULT;
+    if (prev_sep && !(cls & CHAR_SEPARATOR)) {
+      // a keyword is a whole word, up to the next separator
+      int end = i + 1;
+      while (!(classes[(unsigned char)render[end]] & CHAR_SEPARATOR))
+        end++;
+      int kw = editor_syntax_keyword(s, &render[i], end - i);
+      if (kw != HL_DEFAULT) {
+        editor_row_add_hl(row, old, i, end, kw);
+        prev_hl = kw;
+        i = end;
         prev_sep = 0;
         continue;
       }
+      // not one, the rest of the word is plain text
+      do {
+        i++;
+      } while (i < rsize && (classes[(unsigned char)render[i]] & CHAR_WORD));
+      prev_sep = 0;
+      continue;
     }
-    prev_sep = c_is_separator(c);
+
     i++;
+    prev_sep = cls & CHAR_SEPARATOR;
+    if (until >= 0 && i > until && (cls & CHAR_SPACE) &&
+        editor_row_hl_at(row, old, i - 1) == HL_DEFAULT) {
+      editor_row_splice_hl(row, old, start, i);
+      return 0;
+    }
   }
 
-  int changed = (row->hl_open_comment != in_comment);
+  editor_row_splice_hl(row, old, start, INT_MAX);
+  *in_comment_state = in_comment;
+  return 1;
+}
+
+static int editor_highlight_idle();
+
+// The rows after one whose state changed are not lexed here: the frontier
+// moves back to the next row and they get lexed again from there, on screen
+// as they are drawn and off screen in idle time, until the state converges.
+static void editor_row_set_open_comment(editor_row *row, int in_comment) {
+  if (row->hl_open_comment == in_comment)
+    return;
   row->hl_open_comment = in_comment;
 
-  if (changed && row->index + 1 < ec.numRows)
-    editor_row_update_syntax(&ec.row[row->index + 1]);
+  int next = editor_row_tree_index(row) + 1;
+  if (next < ec.buf->hl_frontier) {
+    // rows from the old frontier on may be off from an earlier change
+    ec.buf->hl_checked = ec.buf->hl_frontier;
+    ec.buf->hl_frontier = next;
+    editor_loop_idle(editor_highlight_idle);
+  }
+}
+
+static void editor_row_build_render(editor_row *row);
+
+void editor_row_update_syntax(editor_row *row) {
+  if (row->render == NULL)
+    editor_row_build_render(row);
+
+  editor_row *prev = editor_row_tree_prev(row);
+  int in_comment = (prev != NULL && prev->hl_open_comment);
+  editor_row_lex(row, 0, -1, &in_comment);
+  editor_row_set_open_comment(row, in_comment);
+}
+
+// re-lex after render[from, until) changed, starting from the nearest clean
+// boundary before from
+static void editor_row_update_syntax_span(editor_row *row, int from,
+                                          int until) {
+  editor_row_render *r = row->render;
+  int start = from;
+  while (start > 0 && !(isspace(r->text[start - 1]) &&
+                        editor_row_hl_at(row, r->hl_count, start - 1) ==
+                            HL_DEFAULT))
+    start--;
+
+  int in_comment = 0;
+  if (start == 0) {
+    editor_row *prev = editor_row_tree_prev(row);
+    in_comment = (prev != NULL && prev->hl_open_comment);
+  }
+  if (editor_row_lex(row, start, until, &in_comment))
+    editor_row_set_open_comment(row, in_comment);
 }
 
 void editor_update_syntax() {
-  for (int i = 0; i < ec.numRows; i++) {
-    editor_row_update_syntax(&ec.row[i]);
+  // every highlight is stale, rows get lexed again as they are drawn
+  for (editor_row *row = editor_row_at(0); row;
+       row = editor_row_tree_next(row)) {
+    editor_row_drop_render(row);
   }
+  ec.buf->hl_frontier = 0;
+  ec.buf->hl_checked = 0;
+  ec.buf->hl_drawn_ahead = 0;
 }
 
 // TODO:
@@ -495,348 +891,1347 @@ int editor_syntax_to_color(int hl) {
   }
 }
 
-void editor_select_filetype_syntax() {
-  ec.syntax = NULL;
-  if (ec.filename == NULL)
-    return;
+void editor_select_filetype_syntax() {
+  ec.buf->syntax = NULL;
+  if (ec.buf->filename == NULL)
+    return;
+
+  ec.buf->syntax = editor_syntax_for_file(ec.buf->filename);
+  if (ec.buf->syntax != NULL)
+    editor_update_syntax();
+}
+
+static void editor_render_unlink(editor_row_render *r) {
+  if (r->newer != NULL)
+    r->newer->older = r->older;
+  else
+    ec.buf->newest_render = r->older;
+  if (r->older != NULL)
+    r->older->newer = r->newer;
+  else
+    ec.buf->oldest_render = r->newer;
+  r->newer = NULL;
+  r->older = NULL;
+}
+
+static void editor_render_push_newest(editor_row_render *r) {
+  r->older = ec.buf->newest_render;
+  if (r->older != NULL)
+    r->older->newer = r;
+  else
+    ec.buf->oldest_render = r;
+  ec.buf->newest_render = r;
+}
+
+// the render of row was just used, it is the last one the cache drops
+static void editor_row_touch_render(editor_row *row) {
+  editor_row_render *r = row->render;
+  if (r == NULL || row->block == NULL || ec.buf->newest_render == r)
+    return;
+  editor_render_unlink(r);
+  editor_render_push_newest(r);
+}
+
+// make room for a render of rsize bytes, creating the render of row if it
+// has none
+static void editor_row_reserve_render(editor_row *row, int rsize) {
+  if (row->render == NULL) {
+    row->render = calloc(1, sizeof(editor_row_render));
+    row->render->row = row;
+    // scratch rows, in no block, are not part of the buffer
+    if (row->block != NULL) {
+      ec.buf->rendered_rows++;
+      ec.buf->render_bytes += sizeof(editor_row_render);
+      editor_render_push_newest(row->render);
+    }
+  }
+  editor_row_render *r = row->render;
+  if (rsize + 1 <= r->cap)
+    return;
+  int cap = r->cap ? r->cap : 16;
+  while (cap < rsize + 1)
+    cap *= 2;
+  if (row->block != NULL)
+    ec.buf->render_bytes += cap - r->cap;
+  r->text = realloc(r->text, cap);
+  r->cap = cap;
+}
+
+// render column after c when it is drawn at column rx
+static int editor_render_advance(int rx, char c) {
+  if (c == '\t')
+    return (rx / TAB_SIZE + 1) * TAB_SIZE;
+  return rx + 1;
+}
+
+static void editor_row_build_render(editor_row *row) {
+  int tabs = 0;
+  for (int t = editor_row_find_char(row, 0, '\t'); t != -1;
+       t = editor_row_find_char(row, t + 1, '\t'))
+    tabs++;
+
+  editor_row_reserve_render(row, row->size + tabs * (TAB_SIZE - 1));
+  editor_row_render *r = row->render;
+  r->tabs = tabs;
+  if (r->marks != NULL)
+    r->marks->count = 1;
+
+  // copy the text between tabs as is, expand the tabs to the next stop
+  int idx = 0;
+  int col = 0;
+  int j = 0;
+  while (j < row->size) {
+    int tab = tabs ? editor_row_find_char(row, j, '\t') : -1;
+    int end = tab != -1 ? tab : row->size;
+    editor_row_copy(row, j, end, &r->text[idx]);
+    if (tabs)
+      col = editor_utf8_columns(&r->text[idx], end - j, col);
+    idx += end - j;
+    j = end;
+    if (tab != -1) {
+      do {
+        r->text[idx++] = ' ';
+        col++;
+      } while (col % TAB_SIZE != 0);
+      j++;
+    }
+  }
+
+  r->text[idx] = '\0';
+  r->size = idx;
+  r->nonascii = editor_utf8_count(r->text, idx);
+}
+
+void editor_update_row(editor_row *row) {
+  editor_row_build_render(row);
+  editor_row_update_syntax(row);
+}
+
+void editor_row_drop_render(editor_row *row) {
+  editor_row_free_marks(row);
+  editor_row_render *r = row->render;
+  if (r == NULL)
+    return;
+  if (row->block != NULL) {
+    ec.buf->render_bytes -= sizeof(editor_row_render) + r->cap +
+                            sizeof(editor_hl_span) * (size_t)r->hl_cap;
+    ec.buf->rendered_rows--;
+    editor_render_unlink(r);
+  }
+  free(r->text);
+  free(r->hl);
+  free(r);
+  row->render = NULL;
+}
+
+// A scratch row holds a render and hl reused from row to row to lex rows
+// that are not drawn, without allocating for each of them.
+static void editor_scratch_init(editor_row *scratch) {
+  memset(scratch, 0, sizeof(editor_row));
+  editor_row_reserve_render(scratch, 255);
+}
+
+// lex row in scratch and return the comment state at its end
+static int editor_row_lex_scratch(editor_row *row, editor_row *scratch,
+                                  int in_comment) {
+  scratch->chars = row->chars;
+  scratch->size = row->size;
+  scratch->gap_at = row->gap_at;
+  scratch->gap_len = row->gap_len;
+  editor_row_build_render(scratch);
+  scratch->render->hl_count = 0;
+  editor_row_lex(scratch, 0, -1, &in_comment);
+  return in_comment;
+}
+
+// Lex rows from the frontier up to at so their comment state is known.
+// A row that was not drawn is lexed in a scratch row. When a row ends in the
+// state the next one was lexed with, the rows up to hl_checked still hold and
+// the frontier jumps there.
+static void editor_advance_hl_frontier(int at) {
+  static editor_row scratch;
+  if (scratch.render == NULL)
+    editor_scratch_init(&scratch);
+
+  editor_row *row = editor_row_at(ec.buf->hl_frontier);
+  while (row != NULL && ec.buf->hl_frontier < at) {
+    int open_comment = row->hl_open_comment;
+    if (row->render != NULL) {
+      editor_row_update_syntax(row);
+    } else {
+      editor_row *prev = editor_row_tree_prev(row);
+      int in_comment = prev != NULL && prev->hl_open_comment;
+      editor_row_set_open_comment(
+          row, editor_row_lex_scratch(row, &scratch, in_comment));
+    }
+    ec.buf->hl_frontier++;
+    if (ec.buf->hl_frontier < ec.buf->hl_checked &&
+        row->hl_open_comment == open_comment) {
+      ec.buf->hl_frontier = ec.buf->hl_checked;
+      row = editor_row_at(ec.buf->hl_frontier);
+      continue;
+    }
+    row = editor_row_tree_next(row);
+  }
+}
+
+// end of the rows of b an edit left behind the frontier or drawn past it,
+// rows deleted since they were drawn may leave hl_drawn_ahead past the end
+static int editor_hl_until(editor_buffer *b) {
+  return IMIN(IMAX(b->hl_checked, b->hl_drawn_ahead), b->numRows);
+}
+
+static int editor_hl_pending(editor_buffer *b) {
+  return b->hl_frontier < editor_hl_until(b);
+}
+
+// the buffer to lex in idle time, the current one first and then the others
+// with rows drawn past the frontier
+static editor_buffer *editor_hl_idle_buffer() {
+  if (editor_hl_pending(ec.buf))
+    return ec.buf;
+  for (editor_buffer *b = ec.buffers; b != NULL; b = b->next) {
+    if (b->hl_drawn_ahead > 0 && editor_hl_pending(b))
+      return b;
+  }
+  return NULL;
+}
+
+// Lex a slice of the rows an edit left behind the frontier or that were drawn
+// past it. Queued as an idle task, returns 1 as long as some are left.
+static int editor_highlight_idle() {
+  editor_buffer *b = editor_hl_idle_buffer();
+  if (b == NULL)
+    return 0;
+  editor_buffer *current = ec.buf;
+  ec.buf = b;
+  int from = b->hl_frontier;
+  editor_advance_hl_frontier(IMIN(from + HL_IDLE_ROWS, editor_hl_until(b)));
+  // the rows drawn past the frontier are lexed again as it gets to them
+  if (from < b->hl_drawn_ahead)
+    editor_loop_redraw();
+  if (b->hl_frontier >= IMIN(b->hl_drawn_ahead, b->numRows))
+    b->hl_drawn_ahead = 0;
+  ec.buf = current;
+  return editor_hl_idle_buffer() != NULL;
+}
+
+typedef struct {
+  editor_row *first;
+  int count;
+} editor_hl_chunk;
+
+// Lex a chunk as if it started outside of a comment
+static void *editor_highlight_chunk(void *arg) {
+  editor_hl_chunk *chunk = arg;
+  editor_row scratch;
+  editor_scratch_init(&scratch);
+  int in_comment = 0;
+  editor_row *row = chunk->first;
+  for (int i = 0; i < chunk->count; i++) {
+    in_comment = editor_row_lex_scratch(row, &scratch, in_comment);
+    row->hl_open_comment = in_comment;
+    row = editor_row_tree_next(row);
+  }
+  editor_row_drop_render(&scratch);
+  return NULL;
+}
+
+// Find the comment state of every row on up to nthreads threads. Each one
+// lexes a chunk of rows assuming it does not start in a comment, a sweep then
+// fixes the chunks that did, each one only until the state converges again.
+static void editor_highlight_parallel(int nthreads) {
+  int nchunks = IMIN(nthreads, HL_PARALLEL_MAX_THREADS);
+  nchunks = IMIN(nchunks, ec.buf->numRows / HL_PARALLEL_MIN_ROWS);
+  if (ec.buf->syntax == NULL || nchunks < 2)
+    return;
+
+  editor_hl_chunk chunks[HL_PARALLEL_MAX_THREADS];
+  pthread_t threads[HL_PARALLEL_MAX_THREADS];
+  int threaded[HL_PARALLEL_MAX_THREADS];
+  int per_chunk = (ec.buf->numRows + nchunks - 1) / nchunks;
+  nchunks = (ec.buf->numRows + per_chunk - 1) / per_chunk;
+  for (int i = 0; i < nchunks; i++) {
+    chunks[i].first = editor_row_at(i * per_chunk);
+    chunks[i].count = IMIN(per_chunk, ec.buf->numRows - i * per_chunk);
+  }
+  // the first chunk is lexed on this thread, so is any that fails to start
+  for (int i = 1; i < nchunks; i++) {
+    threaded[i] = pthread_create(&threads[i], NULL, editor_highlight_chunk,
+                                 &chunks[i]) == 0;
+  }
+  editor_highlight_chunk(&chunks[0]);
+  for (int i = 1; i < nchunks; i++) {
+    if (threaded[i])
+      pthread_join(threads[i], NULL);
+    else
+      editor_highlight_chunk(&chunks[i]);
+  }
+
+  static editor_row scratch;
+  if (scratch.render == NULL)
+    editor_scratch_init(&scratch);
+  for (int i = 1; i < nchunks; i++) {
+    editor_row *row = chunks[i].first;
+    editor_row *prev = editor_row_tree_prev(row);
+    if (!prev->hl_open_comment)
+      continue;
+    int in_comment = 1;
+    for (int j = 0; j < chunks[i].count; j++) {
+      in_comment = editor_row_lex_scratch(row, &scratch, in_comment);
+      if (in_comment == row->hl_open_comment)
+        break;
+      row->hl_open_comment = in_comment;
+      row = editor_row_tree_next(row);
+    }
+  }
+  ec.buf->hl_frontier = ec.buf->numRows;
+}
+
+// render and hl are only built for rows that get drawn or edited
+void editor_row_materialize(editor_row *row) {
+  editor_row_touch_render(row);
+  int at = editor_row_tree_index(row);
+  if (row->render != NULL && at < ec.buf->hl_frontier)
+    return;
+  if (row->render == NULL)
+    editor_row_build_render(row);
+  if (at < ec.buf->hl_frontier)
+    editor_row_update_syntax(row);
+  else
+    editor_advance_hl_frontier(at + 1);
+}
+
+// Like editor_row_materialize for a row about to be drawn, without lexing
+// more than a slice of rows from the frontier on. A row further down is
+// lexed with the state the row before holds for now, the frontier gets there
+// in idle time.
+static void editor_row_materialize_drawn(editor_row *row) {
+  int at = editor_row_tree_index(row);
+  if (at < ec.buf->hl_frontier + HL_IDLE_ROWS) {
+    editor_row_materialize(row);
+    return;
+  }
+  editor_row_touch_render(row);
+  if (row->render == NULL)
+    editor_row_build_render(row);
+  // the state is not stored, the row is not lexed in order yet
+  editor_row *prev = editor_row_tree_prev(row);
+  int in_comment = prev != NULL && prev->hl_open_comment > 0;
+  editor_row_lex(row, 0, -1, &in_comment);
+  ec.buf->hl_drawn_ahead = IMAX(ec.buf->hl_drawn_ahead, at + 1);
+  editor_loop_idle(editor_highlight_idle);
+}
+
+static editor_window *editor_window_first(editor_window *n);
+static editor_window *editor_window_next(editor_window *w);
+
+// row at is on or near the view of a window showing ec.buf
+static int editor_row_near_window(int at) {
+  for (editor_window *w = editor_window_first(ec.windows); w != NULL;
+       w = editor_window_next(w)) {
+    if (w->buf == ec.buf && at >= w->rowOffset - w->rows &&
+        at < w->rowOffset + 2 * w->rows)
+      return 1;
+  }
+  return 0;
+}
+
+// Keep at most RENDER_CACHE_ROWS rendered rows, dropping the least recently
+// used ones away from the windows. Rows before the frontier keep their
+// comment state.
+static void editor_trim_render_cache() {
+  // each render is looked at once at most, the ones near a window go back
+  // to the newest end
+  for (int n = ec.buf->rendered_rows;
+       n > 0 && ec.buf->rendered_rows > RENDER_CACHE_ROWS; n--) {
+    editor_row *row = ec.buf->oldest_render->row;
+    if (editor_row_near_window(editor_row_tree_index(row))) {
+      editor_render_unlink(row->render);
+      editor_render_push_newest(row->render);
+    } else {
+      editor_row_drop_render(row);
+    }
+  }
+}
+
+// Chars [at, at + inserted) replaced the removed_len chars in removed.
+// Only that span is re-expanded, plus the chars up to the next tab whose
+// width may change. The rest of render and hl is shifted as is and the
+// highlight is re-lexed until it converges with the old one.
+void editor_update_row_span(editor_row *row, int at, const char *removed,
+                            int removed_len, int inserted) {
+  editor_row_render *r = row->render;
+  // render offsets are columns in rows of ASCII, in others tabs may stop
+  // elsewhere from the edit on
+  int mixed = r->tabs > 0 && r->nonascii > 0;
+  for (int j = 0; j < removed_len; j++) {
+    r->tabs -= removed[j] == '\t';
+    r->nonascii -= (unsigned char)removed[j] >= 0x80;
+  }
+  for (int j = at; j < at + inserted; j++) {
+    char c = editor_row_char(row, j);
+    r->tabs += c == '\t';
+    r->nonascii += (unsigned char)c >= 0x80;
+  }
+  editor_row_cut_marks(row, at);
+  if (mixed || (r->tabs > 0 && r->nonascii > 0)) {
+    editor_update_row(row);
+    return;
+  }
+
+  // nothing before at changed, so is its render offset
+  int rx = editor_row_cx_to_ri(row, at);
+
+  int old_end = rx;
+  for (int j = 0; j < removed_len; j++)
+    old_end = editor_render_advance(old_end, removed[j]);
+
+  int new_end = rx;
+  for (int j = at; j < at + inserted; j++)
+    new_end = editor_render_advance(new_end, editor_row_char(row, j));
+
+  // the next tab absorbs the shift, what follows it keeps its columns
+  int expand_end = at + inserted;
+  if (r->tabs > 0) {
+    int tab = editor_row_find_char(row, expand_end, '\t');
+    if (tab != -1) {
+      int plain = tab - expand_end;
+      old_end = editor_render_advance(old_end + plain, '\t');
+      new_end = editor_render_advance(new_end + plain, '\t');
+      expand_end = tab + 1;
+    }
+  }
+
+  int rsize = r->size + new_end - old_end;
+  editor_row_reserve_render(row, rsize);
+  memmove(&r->text[new_end], &r->text[old_end],
+          r->size - old_end + 1);
+  editor_row_shift_hl(row, rx, old_end, new_end);
+  r->size = rsize;
+
+  int idx = rx;
+  for (int j = at; j < expand_end; j++) {
+    char c = editor_row_char(row, j);
+    int next = editor_render_advance(idx, c);
+    while (idx < next)
+      r->text[idx++] = c == '\t' ? ' ' : c;
+  }
+
+  editor_row_update_syntax_span(row, rx, new_end);
+}
+
+void editor_insert_row(int at, char *line, int linelen) {
+  if (at < 0 || at > ec.buf->numRows)
+    return;
+  editor_row *row = editor_row_tree_insert(&ec.buf->rows, at);
+  ec.buf->numRows++;
+
+  row->size = linelen;
+  row->chars = editor_text_store_append(&ec.buf->store, line, linelen);
+  row->gap_at = linelen;
+  row->gap_len = 0;
+  row->render = NULL;
+  // what the next row was lexed with, so a change still propagates
+  editor_row *prev = editor_row_tree_prev(row);
+  row->hl_open_comment = prev != NULL && prev->hl_open_comment;
+
+  // past the frontier the row is not lexed yet, nor are the ones after it
+  if (at > ec.buf->hl_frontier && at < ec.buf->hl_checked)
+    ec.buf->hl_checked = at;
+  else if (at < ec.buf->hl_checked)
+    ec.buf->hl_checked++;
+  if (at <= ec.buf->hl_frontier) {
+    ec.buf->hl_frontier++;
+    editor_update_row(row);
+  }
+  ec.buf->dirty++;
+}
+
+void editor_row_append_string(editor_row *row, const char *str, size_t len) {
+  if (len < 1 || row == NULL || str == NULL)
+    return;
+  int at = row->size;
+  editor_row_materialize(row);
+  editor_text_store_reserve(&ec.buf->store, row, len);
+  editor_row_move_gap(row, at);
+  memcpy(&row->chars[row->gap_at], str, len);
+  row->gap_at += len;
+  row->gap_len -= len;
+  row->size += len;
+  editor_update_row_span(row, at, NULL, 0, len);
+  ec.buf->dirty++;
+}
+
+typedef struct {
+  size_t at;
+  int len;
+} editor_text_line;
+
+// Split text at \n, \r\n or, with lone_cr, a lone \r: a terminal pastes line
+// breaks as \r. Without it lines end at \n and lose the \r ending them, as
+// when a file is read. Returns the number of lines, there is one more than
+// line breaks.
+static int editor_split_lines(const char *text, size_t len, int lone_cr,
+                              editor_text_line **lines) {
+  int count = 0, cap = 16;
+  editor_text_line *l = malloc(sizeof(editor_text_line) * cap);
+  const char *p = text;
+  const char *end = text + len;
+  // next of each kind of break, searched again only once passed
+  const char *nl = memchr(text, '\n', len);
+  const char *cr = lone_cr ? memchr(text, '\r', len) : NULL;
+  while (1) {
+    if (nl != NULL && nl < p)
+      nl = memchr(p, '\n', end - p);
+    if (cr != NULL && cr < p)
+      cr = memchr(p, '\r', end - p);
+    const char *brk = nl;
+    if (cr != NULL && (brk == NULL || cr < brk))
+      brk = cr;
+    if (count == cap) {
+      cap *= 2;
+      l = realloc(l, sizeof(editor_text_line) * cap);
+    }
+    l[count].at = p - text;
+    l[count].len = (brk != NULL ? brk : end) - p;
+    while (!lone_cr && l[count].len > 0 && p[l[count].len - 1] == '\r')
+      l[count].len--;
+    count++;
+    if (brk == NULL)
+      break;
+    p = brk + 1;
+    if (*brk == '\r' && p < end && *p == '\n')
+      p++;
+  }
+  *lines = l;
+  return count;
+}
+
+// Insert text at the cursor and move the cursor after it, split into lines
+// as editor_split_lines does with lone_cr. The text is split into lines once,
+// they all go into the store as one piece and into the row tree in one
+// splice. The new rows are lexed later, as they get drawn or in idle time,
+// from the frontier moved back to them.
+static void editor_insert_lines(const char *text, size_t len, int lone_cr) {
+  if (len == 0)
+    return;
+  if (ec.win->cy == ec.buf->numRows)
+    editor_insert_row(ec.buf->numRows, "", 0);
+
+  editor_text_line *lines;
+  int count = editor_split_lines(text, len, lone_cr, &lines);
+  editor_row *row = editor_row_at(ec.win->cy);
+  editor_row_materialize(row);
+  int cx = ec.win->cx;
+  // the state the rows after this one were lexed with
+  int open_comment = row->hl_open_comment;
+
+  // what follows the cursor moves to the end of the last line
+  int tail_len = count > 1 ? row->size - cx : 0;
+  char *tail = malloc(tail_len + 1);
+  editor_row_copy(row, cx, cx + tail_len, tail);
+  if (tail_len > 0)
+    editor_text_store_truncate(&ec.buf->store, row, cx);
+
+  int first = lines[0].len;
+  editor_text_store_reserve(&ec.buf->store, row, first);
+  editor_row_move_gap(row, cx);
+  memcpy(&row->chars[row->gap_at], text, first);
+  row->gap_at += first;
+  row->gap_len -= first;
+  row->size += first;
+  editor_update_row_span(row, cx, tail, tail_len, first);
+  ec.win->cx = cx + first;
+
+  if (count > 1) {
+    int at = ec.win->cy + 1;
+    int added = count - 1;
+    size_t from = lines[1].at;
+    char *chars =
+        editor_text_store_append(&ec.buf->store, text + from, len - from);
+    row = editor_row_tree_insert_rows(&ec.buf->rows, at, added);
+    ec.buf->numRows += added;
+    for (int i = 1; i < count; i++) {
+      row->chars = chars + (lines[i].at - from);
+      row->size = lines[i].len;
+      row->gap_at = row->size;
+      row->gap_len = 0;
+      row->render = NULL;
+      row->hl_open_comment = HL_NOT_LEXED;
+      if (i < count - 1)
+        row = editor_row_tree_next(row);
+    }
+
+    // the last line ends at the tail of the store, the tail grows in place
+    editor_text_store_reserve(&ec.buf->store, row, tail_len);
+    memcpy(&row->chars[row->gap_at], tail, tail_len);
+    row->gap_at += tail_len;
+    row->gap_len -= tail_len;
+    row->size += tail_len;
+    // ending the way the row it was split from did, the rows after it hold
+    row->hl_open_comment = open_comment;
+
+    // the rows the frontier passed shifted, they hold once the new ones
+    // converge, a pending chain only if it starts right after them
+    if (at <= ec.buf->hl_frontier) {
+      if (at < ec.buf->hl_frontier || ec.buf->hl_checked < at)
+        ec.buf->hl_checked = ec.buf->hl_frontier;
+      ec.buf->hl_checked += added;
+      ec.buf->hl_frontier = at;
+      editor_loop_idle(editor_highlight_idle);
+    } else if (at < ec.buf->hl_checked) {
+      ec.buf->hl_checked = at;
+    }
+
+    ec.win->cy += added;
+    ec.win->cx = lines[count - 1].len;
+  }
+
+  free(tail);
+  free(lines);
+  ec.buf->dirty++;
+}
+
+// typed or pasted text, a lone \r breaks the line too
+void editor_insert_text(const char *text, size_t len) {
+  editor_insert_lines(text, len, 1);
+}
+
+// text read from a file, its lines split the way editor_load_file does
+void editor_insert_file_text(const char *text, size_t len) {
+  editor_insert_lines(text, len, 0);
+}
+
+void editor_free_row(editor_row *row) {
+  editor_row_drop_render(row);
+}
+
+void editor_delete_row(int at) {
+  if (at < 0 || at >= ec.buf->numRows)
+    return;
+  editor_row *row = editor_row_at(at);
+  int open_comment = row->hl_open_comment;
+  editor_free_row(row);
+  editor_row_tree_delete(&ec.buf->rows, at);
+  ec.buf->numRows--;
+  // past the frontier the next row loses the state it was lexed with
+  if (at > ec.buf->hl_frontier && at < ec.buf->hl_checked)
+    ec.buf->hl_checked = at;
+  else if (at < ec.buf->hl_checked)
+    ec.buf->hl_checked--;
+  if (at < ec.buf->hl_frontier)
+    ec.buf->hl_frontier--;
+
+  // the next row was lexed after the deleted one
+  editor_row *prev = editor_row_at(at - 1);
+  editor_row *next = editor_row_at(at);
+  if (next != NULL && at < ec.buf->hl_frontier &&
+      (prev != NULL && prev->hl_open_comment) != open_comment)
+    editor_row_update_syntax(next);
+  ec.buf->dirty++;
+  if (ec.buf->filename == NULL && ec.buf->numRows == 0) {
+    ec.buf->dirty = 0;
+  }
+}
+
+// count '\n' in buf, 16 bytes at a time when SSE2 is available
+size_t editor_count_lines(const char *buf, size_t len) {
+  size_t count = 0;
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl)));
+  }
+#endif
+  for (; i < len; i++) {
+    if (buf[i] == '\n')
+      count++;
+  }
+  return count;
+}
+
+static double editor_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define FILE_READ_BLOCK (1 << 20)
+
+// read the whole fd into a single heap block
+// stat size is only a hint so pipes and growing files still work
+static char *editor_read_fd(int fd, size_t *len) {
+  struct stat st;
+  size_t cap = FILE_READ_BLOCK;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    cap = st.st_size + 1;
+
+  char *buf = malloc(cap);
+  if (buf == NULL)
+    return NULL;
+
+  *len = 0;
+  while (1) {
+    if (*len == cap) {
+      cap *= 2;
+      char *grown = realloc(buf, cap);
+      if (grown == NULL) {
+        free(buf);
+        return NULL;
+      }
+      buf = grown;
+    }
+    size_t want = cap - *len;
+    if (want > FILE_READ_BLOCK * 64)
+      want = FILE_READ_BLOCK * 64;
+    ssize_t nread = read(fd, buf + *len, want);
+    if (nread == 0)
+      break;
+    if (nread == -1) {
+      if (errno == EINTR)
+        continue;
+      free(buf);
+      return NULL;
+    }
+    *len += nread;
+  }
+
+  return buf;
+}
+
+// add an empty buffer at the end of the buffer list
+static editor_buffer *editor_buffer_new() {
+  editor_buffer *b = calloc(1, sizeof(editor_buffer));
+  editor_buffer **tail = &ec.buffers;
+  while (*tail != NULL)
+    tail = &(*tail)->next;
+  *tail = b;
+  // the first buffer comes with the first window
+  if (ec.windows == NULL) {
+    ec.windows = calloc(1, sizeof(editor_window));
+    ec.windows->buf = b;
+    ec.win = ec.windows;
+  }
+  return b;
+}
+
+// Free b, the current buffer, and take it out of the list. The windows that
+// showed it are left without a buffer until they are given one.
+static void editor_buffer_free(editor_buffer *b) {
+  editor_free_current_buffer();
+  editor_buffer **link = &ec.buffers;
+  while (*link != b)
+    link = &(*link)->next;
+  *link = b->next;
+  for (editor_window *w = editor_window_first(ec.windows); w != NULL;
+       w = editor_window_next(w)) {
+    if (w->buf == b)
+      w->buf = NULL;
+  }
+  free(b);
+}
 
-  char *ext = strstr(ec.filename, ".");
-
-  for (unsigned int i = 0; i < HLDB_ENTRIES; i++) {
-    editor_syntax *s = &HLDB[i];
-    unsigned int j = 0;
-    while (s->filematches[j]) {
-      int is_ext = s->filematches[j][0] == '.';
-      if ((is_ext && ext && !strcmp(ext, s->filematches[j])) ||
-          (!is_ext && strstr(ec.filename, s->filematches[j]))) {
-        ec.syntax = s;
-        editor_update_syntax();
-        return;
-      }
-      j++;
+// files at least this big open in paging mode, 0 to never page: the default
+// only applies from editor_init on, --bench-highlight loads every file
+static size_t editor_pager_min_bytes;
+
+// Read filename into the current buffer, replacing what it held. Returns -1
+// and leaves the buffer as it was when the file cannot be read.
+static int editor_load_file(char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    editor_set_status_msg("Error: File \"%s\" not found", filename);
+    return -1;
+  }
+
+  // too big to load, it is looked at through a mapping instead
+  struct stat st;
+  if (editor_pager_min_bytes > 0 && fstat(fd, &st) == 0 &&
+      S_ISREG(st.st_mode) && (size_t)st.st_size >= editor_pager_min_bytes) {
+    editor_pager *pager = editor_pager_open(fd, st.st_size);
+    if (pager != NULL) {
+      close(fd);
+      editor_free_current_buffer();
+      ec.buf->pager = pager;
+      ec.buf->filename = strdup(filename);
+      editor_set_status_msg("Opened %.1f MB read only, too big to edit",
+                            st.st_size / (1024.0 * 1024.0));
+      return 0;
     }
   }
-}
 
-void editor_update_row(editor_row *row) {
-  int j, nl = 0, tabs = 0;
+  double start = editor_now();
+  size_t len;
+  char *buf = editor_read_fd(fd, &len);
+  close(fd);
+  if (buf == NULL) {
+    editor_set_status_msg("Error: could not read \"%s\": %s", filename,
+                          strerror(errno));
+    return -1;
+  }
+
+  editor_free_current_buffer();
+
+  ec.buf->filename = strdup(filename);
+  editor_text_store_init(&ec.buf->store, buf, len);
+  editor_select_filetype_syntax();
+
+  // size the row tree once, the last line may lack a trailing newline
+  size_t lines = editor_count_lines(buf, len);
+  if (len > 0 && buf[len - 1] != '\n')
+    lines++;
+  ec.buf->rows = editor_row_tree_build(lines);
+
+  // rows are views into buf, edits never touch it
+  char *p = buf;
+  char *end = buf + len;
+  int at = 0;
+  editor_row *row = editor_row_at(0);
+  while (p < end) {
+    char *eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+    int linelen = eol - p;
+    while (linelen > 0 && p[linelen - 1] == '\r')
+      linelen--;
 
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t')
-      tabs++;
+    row->chars = p;
+    row->size = linelen;
+    row->gap_at = linelen;
+    row->gap_len = 0;
+    row->render = NULL;
+    row->hl_open_comment = 0;
+    row = editor_row_tree_next(row);
+    at++;
+    p = eol + 1;
   }
 
-  if (row->render != NULL)
-    free(row->render);
+  // render and hl are built lazily once rows get drawn
+  ec.buf->numRows = at;
+  ec.buf->hl_frontier = 0;
+  ec.buf->hl_checked = 0;
+  ec.buf->hl_drawn_ahead = 0;
 
-  row->render = malloc(row->size + tabs * (TAB_SIZE - 1) + 1);
+  // big files are lexed up front on every core, others as rows get drawn
+  editor_highlight_parallel(sysconf(_SC_NPROCESSORS_ONLN));
 
-  int idx = 0;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % TAB_SIZE != 0)
-        row->render[idx++] = ' ';
-    } else {
-      row->render[idx++] = row->chars[j];
-    }
+  if (ec.buf->numRows == 0) {
+    editor_insert_row(0, "", 0);
   }
 
-  row->render[idx] = '\0';
-  row->rsize = idx;
+  ec.buf->dirty = 0;
+  ec.buf->file_size = len;
 
-  editor_row_update_syntax(row);
+  double elapsed = editor_now() - start;
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+  double mb = len / (1024.0 * 1024.0);
+  editor_set_status_msg("Opened %d lines, %.1f MB in %.0f ms (%.0f lines/s, "
+                        "%.1f MB/s)",
+                        at, mb, elapsed * 1000, at / elapsed, mb / elapsed);
+  return 0;
 }
 
-void editor_insert_row(int at, char *line, int linelen) {
-  if (at < 0 || at > ec.numRows)
-    return;
-  // realloc a new row
-  ec.row = realloc(ec.row, sizeof(editor_row) * (ec.numRows + 1));
-  memmove(&ec.row[at + 1], &ec.row[at], sizeof(editor_row) * (ec.numRows - at));
+static void editor_switch_buffer(editor_buffer *b);
+static void editor_show_buffer(editor_window *w, editor_buffer *b);
 
-  // increment next row indexes
-  for (int i = at + 1; i < ec.numRows; i++)
-    ec.row[i].index++;
-
-  ec.row[at].index = at;
-  ec.row[at].size = linelen;
-  ec.row[at].chars = malloc(linelen + 1);
+// a and b name the same file, through another path or a link
+static int editor_same_file(const char *a, const char *b) {
+  struct stat sa, sb;
+  if (!strcmp(a, b))
+    return 1;
+  return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev &&
+         sa.st_ino == sb.st_ino;
+}
 
-  memcpy(ec.row[at].chars, line, linelen);
-  ec.row[at].chars[linelen] = '\0';
-  ec.row[at].rsize = 0;
-  ec.row[at].render = NULL;
-  ec.row[at].hl = NULL;
-  ec.row[at].hl_open_comment = 0;
+// Open filename in a buffer of its own, the buffer already holding it is
+// shown again as it was. An empty buffer nothing was typed in is reused.
+void editor_open_file(char *filename) {
+  for (editor_buffer *b = ec.buffers; b != NULL; b = b->next) {
+    if (b->filename != NULL && editor_same_file(b->filename, filename)) {
+      editor_switch_buffer(b);
+      return;
+    }
+  }
 
-  editor_update_row(&ec.row[at]);
-  ec.numRows++;
-  ec.dirty++;
+  editor_buffer *prev = ec.buf;
+  int fresh = prev == NULL || prev->filename != NULL || prev->dirty;
+  if (fresh && prev != NULL)
+    editor_switch_buffer(editor_buffer_new());
+  else if (fresh)
+    ec.buf = editor_buffer_new();
+  if (editor_load_file(filename) == -1 && fresh && prev != NULL) {
+    editor_buffer_free(ec.buf);
+    editor_show_buffer(ec.win, prev);
+  }
 }
 
-void editor_row_append_string(editor_row *row, const char *str, size_t len) {
-  if (len < 1 || row == NULL || str == NULL)
+// Highlight all of filename without a terminal and print the lexer
+// throughput on one core, then on nthreads, see --bench-highlight.
+void editor_bench_highlight(char *filename, int nthreads) {
+  editor_open_file(filename);
+  if (ec.buf->filename == NULL) {
+    printf("%s\n", ec.statusmsg);
     return;
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], str, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
-  editor_update_row(row);
-  ec.dirty++;
+  }
+
+  size_t bytes = 0;
+  for (editor_row *row = editor_row_at(0); row;
+       row = editor_row_tree_next(row))
+    bytes += row->size + 1;
+  double mb = bytes / (1024.0 * 1024.0);
+  printf("%s: %s, %d lines, %.1f MB\n", filename,
+         ec.buf->syntax ? ec.buf->syntax->filetype : "no syntax",
+         ec.buf->numRows, mb);
+
+  ec.buf->hl_frontier = 0;
+  double start = editor_now();
+  editor_advance_hl_frontier(ec.buf->numRows);
+  double elapsed = editor_now() - start;
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+  printf("1 thread: %.0f ms (%.1f MB/s)\n", elapsed * 1000, mb / elapsed);
+
+  ec.buf->hl_frontier = 0;
+  start = editor_now();
+  editor_highlight_parallel(nthreads);
+  if (ec.buf->hl_frontier < ec.buf->numRows) {
+    printf("%d threads: too few rows to split\n", nthreads);
+    return;
+  }
+  elapsed = editor_now() - start;
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+  printf("%d threads: %.0f ms (%.1f MB/s)\n", nthreads, elapsed * 1000,
+         mb / elapsed);
 }
 
-void editor_free_row(editor_row *row) {
-  free(row->render);
-  free(row->chars);
-  free(row->hl);
+// The window layout is a binary tree, its leaves are the windows. A split
+// node gives half of its area to each child, side by side or one above the
+// other, so the layout follows the terminal as it is resized. Windows on the
+// same buffer share its rows, with their render and highlight.
+
+// first window of the subtree n, in screen order
+static editor_window *editor_window_first(editor_window *n) {
+  while (n->first != NULL)
+    n = n->first;
+  return n;
 }
 
-void editor_delete_row(int at) {
-  if (at < 0 || at >= ec.numRows)
-    return;
-  editor_free_row(&ec.row[at]);
-  memmove(&ec.row[at], &ec.row[at + 1],
-          sizeof(editor_row) * (ec.numRows - at - 1));
-  // decrement next row indexes
-  for (int i = at; i < ec.numRows; i++)
-    ec.row[i].index--;
-  ec.numRows--;
-  ec.dirty++;
-  if (ec.filename == NULL && ec.numRows == 0) {
-    ec.dirty = 0;
-  }
+// window after w in screen order, NULL after the last one
+static editor_window *editor_window_next(editor_window *w) {
+  while (w->parent != NULL && w->parent->second == w)
+    w = w->parent;
+  return w->parent != NULL ? editor_window_first(w->parent->second) : NULL;
 }
 
-void editor_open_file(char *filename) {
-  FILE *fp = fopen(filename, "r");
-  if (!fp) {
-    editor_set_status_msg("Error: File \"%s\" not found", filename);
+// Give node n the area of rows x cols at top, left, a window takes its last
+// row for its status bar. A bar of one column goes between two windows side
+// by side.
+static void editor_layout_windows(editor_window *n, int top, int left,
+                                  int rows, int cols) {
+  if (n->first == NULL) {
+    n->top = top;
+    n->left = left;
+    n->rows = rows - 1;
+    n->cols = cols;
     return;
   }
-  editor_free_current_buffer();
-
-  ec.filename = strdup(filename);
-  editor_select_filetype_syntax();
+  if (n->vertical) {
+    int half = (cols - 1) / 2;
+    editor_layout_windows(n->first, top, left, rows, half);
+    editor_layout_windows(n->second, top, left + half + 1, rows,
+                          cols - half - 1);
+    for (int y = top; y < top + rows; y++)
+      editor_screen_put(&ec.screen, y, left + half, " ", 1,
+                        SCREEN_INVERSE | SCREEN_DEFAULT);
+  } else {
+    int half = rows / 2;
+    editor_layout_windows(n->first, top, left, half, cols);
+    editor_layout_windows(n->second, top + half, left, rows - half, cols);
+  }
+}
 
-  char *line = NULL;
-  size_t linecap = 0;
-  int linelen;
+// Draw the render of row from column colOffset on at row y of window w, the
+// columns [match_start, match_end) of nmatches search matches over the
+// highlight. The color is looked up where a span or a match starts or ends,
+// the printable ASCII between goes to the screen in one piece.
+static void editor_draw_render(editor_window *w, int y, editor_row *row,
+                               int nmatches, const int *match_start,
+                               const int *match_end) {
+  editor_row_render *r = row->render;
+  editor_screen *screen = &ec.screen;
+  int edge = w->colOffset + w->cols;
+  // the character over the first column, it may start left of it
+  editor_col_mark at = editor_row_col_at(row, w->colOffset);
+  int i = at.ri;
+  int rx = at.rx;
+  int match = 0;
+  y += w->top;
+  // span at or after i, the render byte and the column where color changes
+  int span = editor_row_hl_find(row, r->hl_count, i);
+  int hl_end = i, match_next = rx;
+  int color = 0;
+
+  while (i < r->size && rx < edge) {
+    int cp = (unsigned char)r->text[i];
+    int n = 1, width = 1;
+    if (cp >= 0x80) {
+      n = editor_utf8_decode(&r->text[i], r->size - i, &cp);
+      width = editor_utf8_width(cp);
+    }
+    // spaces of a tab left of the window are skipped, the half of a wide
+    // character it shows is blank, marks on a character left of it go
+    if (rx < w->colOffset || rx + width > edge ||
+        (width == 0 && rx == w->colOffset)) {
+      for (int x = IMAX(rx, w->colOffset); x < IMIN(rx + width, edge); x++)
+        editor_screen_put(screen, y, w->left + x - w->colOffset, " ", 1,
+                          SCREEN_DEFAULT);
+      i += n;
+      rx += width;
+      continue;
+    }
 
-  while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    while (linelen > 0 &&
-           (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
+    if (i >= hl_end || rx >= match_next) {
+      while (span < r->hl_count &&
+             r->hl[span].start + r->hl[span].len <= i)
+        span++;
+      int hl = HL_DEFAULT;
+      hl_end = r->size;
+      if (span < r->hl_count && r->hl[span].start <= i) {
+        hl = r->hl[span].hl;
+        hl_end = r->hl[span].start + r->hl[span].len;
+      } else if (span < r->hl_count) {
+        hl_end = r->hl[span].start;
+      }
+      while (match < nmatches && rx >= match_end[match])
+        match++;
+      match_next = INT_MAX;
+      if (match < nmatches && rx >= match_start[match]) {
+        hl = HL_SEARCH_RESULT;
+        match_next = match_end[match];
+      } else if (match < nmatches) {
+        match_next = match_start[match];
+      }
+      color = editor_syntax_to_color(hl);
+    }
 
-      linelen--;
+    int x = w->left + rx - w->colOffset;
+    if (cp >= 0x20 && cp < 0x7f) {
+      // a column a byte up to the next change of color or the edge
+      int stop = IMIN(hl_end, i + IMIN(edge, match_next) - rx);
+      while (n < stop - i && r->text[i + n] >= 0x20 &&
+             r->text[i + n] < 0x7f)
+        n++;
+      width = n;
+      editor_screen_put(screen, y, x, &r->text[i], n, color);
+    } else if (cp < 0x20 || cp == 0x7f) {
+      char sym = (cp <= 26 ? '@' + cp : '?');
+      editor_screen_put(screen, y, x, &sym, 1, SCREEN_INVERSE | color);
+    } else if (cp < 0 || (cp >= 0x80 && cp < 0xa0)) {
+      // invalid bytes, and C1 controls the terminal would act on
+      editor_screen_put(screen, y, x, "?", 1, SCREEN_INVERSE | color);
+    } else {
+      editor_screen_put(screen, y, x, &r->text[i], n, color);
     }
-    editor_insert_row(ec.numRows, line, linelen);
+    i += n;
+    rx += width;
   }
+}
 
-  if (ec.numRows == 0) {
-    editor_insert_row(0, "", 0);
-  }
+// last search of the paging mode, its query is NULL before the first one
+static editor_search editor_page_search;
+static char *editor_page_query;
+static int editor_page_ignore_case;
 
-  free(line);
-  fclose(fp);
+// display column of the byte at at, on the line starting at start
+static int editor_page_rx(const char *text, size_t start, size_t at) {
+  return editor_utf8_columns(text + start, at - start, 0);
+}
 
-  ec.dirty = 0;
+// Lines in paging mode are views into the mapping like rows in orig, each
+// rendered in a scratch row as it gets drawn. A column takes four bytes at
+// most, combining marks aside, so no more of a line than four bytes a column
+// up to the right edge is rendered.
+static void editor_page_draw_rows(editor_window *w) {
+  static editor_row scratch;
+  if (scratch.render == NULL)
+    editor_scratch_init(&scratch);
+
+  size_t size;
+  const char *text = editor_pager_text(ec.buf->pager, &size);
+  size_t at = w->page_top;
+  for (int y = 0; y < w->rows; y++) {
+    if (at >= size) {
+      editor_screen_put(&ec.screen, w->top + y, w->left, "~", 1,
+                        SCREEN_DEFAULT);
+      continue;
+    }
+    size_t next = editor_pager_next_line(ec.buf->pager, at);
+    size_t linelen = next - at;
+    if (linelen > 0 && text[at + linelen - 1] == '\n')
+      linelen--;
+    while (linelen > 0 && text[at + linelen - 1] == '\r')
+      linelen--;
+    size_t edge = (size_t)(w->colOffset + w->cols) * 4;
+    int len = linelen < edge ? linelen : edge;
+
+    scratch.chars = (char *)text + at;
+    scratch.size = len;
+    scratch.gap_at = len;
+    scratch.gap_len = 0;
+    editor_row_build_render(&scratch);
+    scratch.render->hl_count = 0;
+
+    // matches starting on screen, they may end past the edge
+    int match_start[MAX_ROW_MATCHES], match_end[MAX_ROW_MATCHES];
+    int nmatches = 0;
+    if (editor_page_query != NULL) {
+      editor_search *s = &editor_page_search;
+      size_t reach = (size_t)len + s->len - 1;
+      size_t hay = linelen < reach ? linelen : reach;
+      size_t from = 0;
+      long found;
+      while (nmatches < MAX_ROW_MATCHES && from < hay &&
+             (found = editor_search_buf(s, text + at + from, hay - from)) !=
+                 -1) {
+        int m = from + found;
+        match_start[nmatches] = editor_row_cx_to_rx(&scratch, m);
+        match_end[nmatches] =
+            editor_row_cx_to_rx(&scratch, IMIN(m + s->len, len));
+        nmatches++;
+        from = m + 1;
+      }
+    }
+    editor_draw_render(w, y, &scratch, nmatches, match_start, match_end);
+    at = next;
+  }
 }
 
-void editor_draw_rows(buffer *ab) {
+// Draw the rows of the buffer of w, which is ec.buf, in its text area. They
+// are rendered and lexed once for all the windows showing them.
+void editor_draw_rows(editor_window *w) {
+  if (ec.buf->pager != NULL) {
+    editor_page_draw_rows(w);
+    return;
+  }
+  editor_screen *screen = &ec.screen;
   int y;
-  for (y = 0; y < ec.screenRows; y++) {
-    int fileRow = y + ec.rowOffset;
-    if (fileRow >= ec.numRows) {
+  for (y = 0; y < w->rows; y++) {
+    int fileRow = y + w->rowOffset;
+    int top = w->top + y;
+    if (fileRow >= ec.buf->numRows) {
       // draw editor starting screen
-      if (ec.numRows == 0 && y == (ec.screenRows / 2) - 2) {
+      if (ec.buf->numRows == 0 && y == (w->rows / 2) - 2) {
         char message[64];
         int messageLen =
             snprintf(message, sizeof(message), "Dictée - version %s", VERSION);
-        if (messageLen > ec.screenCols)
-          messageLen = ec.screenCols;
-        int padding = (ec.screenCols - messageLen) / 2;
-        if (padding) {
-          buffer_append(ab, "~", 1);
-          padding--;
-        }
-        while (padding--)
-          buffer_append(ab, " ", 1);
-        buffer_append(ab, message, messageLen);
+        if (messageLen > w->cols)
+          messageLen = w->cols;
+        int padding = (w->cols - messageLen) / 2;
+        if (padding)
+          editor_screen_put(screen, top, w->left, "~", 1, SCREEN_DEFAULT);
+        editor_screen_put(screen, top, w->left + padding, message, messageLen,
+                          SCREEN_DEFAULT);
       } else {
-        buffer_append(ab, "~", 1);
+        editor_screen_put(screen, top, w->left, "~", 1, SCREEN_DEFAULT);
       }
     } else {
-      int len = ec.row[fileRow].rsize - ec.colOffset;
-      len = len < 0 ? 0 : len;
-      len = len > ec.screenCols ? ec.screenCols : len;
-      char *c = &ec.row[fileRow].render[ec.colOffset];
-      unsigned char *hl = &ec.row[fileRow].hl[ec.colOffset];
-      int current_color = -1;
-      for (int i = 0; i < len; i++) {
-        int color = editor_syntax_to_color(hl[i]);
-        if (iscntrl(c[i])) {
-          char sym = (c[i] <= 26 ? '@' + c[i] : '?');
-          buffer_append(ab, "\x1b[7m", 4);
-          buffer_append(ab, &sym, 1);
-          buffer_append(ab, "\x1b[m", 3);
-          if (current_color != -1) {
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-            buffer_append(ab, buf, clen);
-          }
-        } else {
-          if (current_color != color) {
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-            buffer_append(ab, buf, clen);
-          }
-          current_color = color;
-          buffer_append(ab, &c[i], 1);
-        }
+      editor_row *row = editor_row_at(fileRow);
+      editor_row_materialize_drawn(row);
+
+      // search matches are drawn over the highlight, as render spans, in
+      // the windows on the buffer searched
+      editor_match matches[MAX_ROW_MATCHES];
+      int match_start[MAX_ROW_MATCHES], match_end[MAX_ROW_MATCHES];
+      int nmatches = 0;
+      if (w->buf == ec.win->buf)
+        nmatches = editor_match_index_row(fileRow, matches, MAX_ROW_MATCHES);
+      for (int j = 0; j < nmatches; j++) {
+        match_start[j] = editor_row_cx_to_rx(row, matches[j].at);
+        match_end[j] =
+            editor_row_cx_to_rx(row, matches[j].at + matches[j].len);
       }
-      // reset to default color at end of line
-      // to prevent last line from coloring all
-      // the rest of the term ?
-      // Maybe I should just specify the color
-      // directly in draw_status_bar etc
-      buffer_append(ab, "\x1b[m", 3);
+      editor_draw_render(w, y, row, nmatches, match_start, match_end);
     }
-
-    // clear from cursor to end of line
-    buffer_append(ab, "\x1b[K", 3);
-    // clear line
-    buffer_append(ab, "\r\n", 2);
   }
 }
 
-void editor_draw_status_bar(buffer *ab) {
-  buffer_append(ab, "\x1b[7m", 4);
+// the bar below the text area of w
+void editor_draw_status_bar(editor_window *w) {
+  int y = w->top + w->rows;
+  unsigned char attr = SCREEN_INVERSE | SCREEN_DEFAULT;
   char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                     ec.filename ? ec.filename : "[No Name]", ec.numRows,
-                     ec.dirty ? "(modified)" : "");
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%s | [%d/%d] %d/%d",
-                      ec.syntax ? ec.syntax->filetype : "no ft", ec.cx, ec.cy,
-                      ec.cy + 1, ec.numRows);
-  if (len > ec.screenCols)
-    len = ec.screenCols;
-  buffer_append(ab, status, len);
-  while (len < ec.screenCols) {
-    if (ec.screenCols - len == rlen) {
-      buffer_append(ab, rstatus, rlen);
-      break;
-    } else {
-      buffer_append(ab, " ", 1);
-      len++;
-    }
+  int len, rlen;
+  if (ec.buf->pager != NULL) {
+    // the line count grows while the pager is counting
+    int done;
+    long lines = editor_pager_lines(ec.buf->pager, &done);
+    long line = editor_pager_line_number(ec.buf->pager, w->page_top);
+    char top[24] = "?";
+    if (line != -1)
+      snprintf(top, sizeof(top), "%ld", line + 1);
+    len = snprintf(status, sizeof(status), "%.20s - %ld%s lines (read only)",
+                   ec.buf->filename, lines, done ? "" : "+");
+    rlen = snprintf(rstatus, sizeof(rstatus), "line %s/%ld%s", top, lines,
+                    done ? "" : "+");
+  } else {
+    len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+                   ec.buf->filename ? ec.buf->filename : "[No Name]",
+                   ec.buf->numRows, ec.buf->dirty ? "(modified)" : "");
+    // the search is the one of the current window
+    char search[40] = "";
+    int k, n, done;
+    const char *error = w == ec.win ? editor_match_index_error() : NULL;
+    if (error != NULL)
+      snprintf(search, sizeof(search), "regex: %s | ", error);
+    else if (w == ec.win && editor_match_index_status(&k, &n, &done))
+      snprintf(search, sizeof(search), "match %d of %d%s | ", k, n,
+               done ? "" : "+");
+    rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | [%d/%d] %d/%d", search,
+                    ec.buf->syntax ? ec.buf->syntax->filetype : "no ft",
+                    w->cx, w->cy, w->cy + 1, ec.buf->numRows);
   }
-  buffer_append(ab, "\x1b[m", 3);
-  buffer_append(ab, "\r\n", 2);
+  if (len > w->cols)
+    len = w->cols;
+  editor_screen_put(&ec.screen, y, w->left, status, len, attr);
+  // the bar is reversed end to end
+  for (int x = len; x < w->cols; x++)
+    editor_screen_put(&ec.screen, y, w->left + x, " ", 1, attr);
+  if (w->cols - len >= rlen)
+    editor_screen_put(&ec.screen, y, w->left + w->cols - rlen, rstatus, rlen,
+                      attr);
 }
 
-void editor_draw_message_bar(buffer *ab) {
-  buffer_append(ab, "\x1b[K", 3);
+void editor_draw_message_bar() {
   int msglen = strlen(ec.statusmsg);
-  if (msglen > ec.screenCols)
-    strlen(ec.statusmsg);
-  if (msglen && time(NULL) - ec.statusmsg_time < 5)
-    buffer_append(ab, ec.statusmsg, msglen);
+  if (msglen && time(NULL) - ec.statusmsg_time < STATUS_MSG_SECONDS)
+    editor_screen_put(&ec.screen, ec.screenRows + 1, 0, ec.statusmsg, msglen,
+                      SCREEN_DEFAULT);
 }
 
+// the message bar is drawn again without it
+static void editor_status_msg_expire() { ec.statusmsg[0] = '\0'; }
+
 void editor_set_status_msg(const char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
   vsnprintf(ec.statusmsg, sizeof(ec.statusmsg), fmt, ap);
   va_end(ap);
   ec.statusmsg_time = time(NULL);
+  editor_loop_timer(STATUS_MSG_SECONDS * 1000, editor_status_msg_expire);
 }
 
-void editor_scroll() {
-  ec.rx = 0;
-
-  if (ec.cy < ec.numRows) {
-    ec.rx = editor_row_cx_to_rx(&ec.row[ec.cy], ec.cx);
+// Move the view of w, on ec.buf, so its cursor is in the text area. Edits in
+// another window on the buffer may have left the cursor past its end.
+void editor_scroll(editor_window *w) {
+  w->rx = 0;
+  w->cy = IMIN(w->cy, ec.buf->numRows);
+  editor_row *row = editor_row_at(w->cy);
+  w->cx = IMIN(w->cx, row ? row->size : 0);
+
+  if (row != NULL) {
+    editor_row_materialize_drawn(row);
+    w->rx = editor_row_cx_to_rx(row, w->cx);
   }
 
   // scroll back
-  if (ec.cy - SCROLL_OFFSET < ec.rowOffset) {
-    ec.rowOffset = IMAX(0, ec.cy - SCROLL_OFFSET);
+  if (w->cy - SCROLL_OFFSET < w->rowOffset) {
+    w->rowOffset = IMAX(0, w->cy - SCROLL_OFFSET);
   }
 
   // scroll down
-  if (ec.cy + SCROLL_OFFSET >= ec.rowOffset + ec.screenRows) {
-    ec.rowOffset = (ec.cy + SCROLL_OFFSET) - ec.screenRows + 1;
+  if (w->cy + SCROLL_OFFSET >= w->rowOffset + w->rows) {
+    w->rowOffset = (w->cy + SCROLL_OFFSET) - w->rows + 1;
   }
 
-  if (ec.rx < ec.colOffset) {
-    ec.colOffset = ec.rx;
+  if (w->rx < w->colOffset) {
+    w->colOffset = w->rx;
   }
 
-  if (ec.rx >= ec.colOffset + ec.screenCols) {
-    ec.colOffset = ec.rx - ec.screenCols + 1;
+  if (w->rx >= w->colOffset + w->cols) {
+    w->colOffset = w->rx - w->cols + 1;
   }
 }
 
 void editor_refresh_screen() {
-  editor_refresh_window_size();
-  editor_scroll();
+  // windows, their bars and the message bar
+  editor_screen_resize(&ec.screen, ec.screenRows + 2, ec.screenCols);
+  editor_screen_clear(&ec.screen);
+  editor_layout_windows(ec.windows, 0, 0, ec.screenRows + 1, ec.screenCols);
+
+  // only what changed since the last frame goes out, rows a view moved over
+  // are scrolled by the terminal when its window spans the whole width
   buffer ab = BUFFER_INIT;
+  for (editor_window *w = editor_window_first(ec.windows); w != NULL;
+       w = editor_window_next(w)) {
+    // the rows drawn are the ones of the buffer shown
+    ec.buf = w->buf;
+    // the paging mode moves the view itself, the cursor stays top left
+    if (ec.buf->pager != NULL)
+      w->rx = w->colOffset;
+    else
+      editor_scroll(w);
+    editor_draw_rows(w);
+    editor_draw_status_bar(w);
+    editor_trim_render_cache();
+
+    if (w->buf == w->drawn_buf && w->colOffset == w->drawn_col &&
+        w->cols == ec.screenCols)
+      editor_screen_scroll(&ec.screen, &ab, w->top, w->top + w->rows,
+                           w->rowOffset - w->drawn_row);
+    w->drawn_buf = w->buf;
+    w->drawn_row = w->rowOffset;
+    w->drawn_col = w->colOffset;
+  }
+  ec.buf = ec.win->buf;
+  editor_draw_message_bar();
 
-  // https://vt100.net/docs/vt100-ug/chapter3.html
-  // for details on escape sequence
-  // hide cursor to prevent flickering
-  buffer_append(&ab, "\x1b[?25l", 6);
-  // this one basically means clear the entire screen
-  // but now we do it line by line
-  /* buffer_append(&ab, "\x1b[2J", 4); */
-  // postition cursor top left
-  buffer_append(&ab, "\x1b[H", 3);
-
-  editor_draw_rows(&ab);
-  editor_draw_status_bar(&ab);
-  editor_draw_message_bar(&ab);
-
-  // position cursor to actual cursor position
-  char buf[32];
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (ec.cy - ec.rowOffset) + 1,
-           (ec.rx - ec.colOffset) + 1);
-  buffer_append(&ab, buf, str_len(buf));
-
-  // show cursor
-  buffer_append(&ab, "\x1b[?25h", 6);
-
-  if (write(STDOUT_FILENO, ab.b, ab.len) != ab.len) {
+  if (editor_screen_flush(&ec.screen, &ab,
+                          ec.win->top + ec.win->cy - ec.win->rowOffset,
+                          ec.win->left + ec.win->rx - ec.win->colOffset) &&
+      write(STDOUT_FILENO, ab.b, ab.len) != ab.len) {
     DEBUG_PRINT("Error: editor_refresh_screen couldn't write the full buffer");
-  };
+  }
   free_buffer(&ab);
 }
 
 int editor_read_key() {
-  int nread;
   char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-    /*
-     * In Cygwin, when read() times out it returns -1 with an errno of EAGAIN,
-     * instead of just returning 0 like it’s supposed to. To make it work in
-     * Cygwin, we won’t treat EAGAIN as an error.
-     * */
-    if (nread == -1 && errno != EAGAIN)
-      die("read");
-  }
+  // idle work runs until a key comes in, other events come back as keys
+  int event = editor_loop_wait();
+  if (event)
+    return event;
+  editor_input_byte(&c, -1);
 
   // handle escape sequences
   if (c == ESC) {
-    char seq[3];
+    char seq[4] = {0};
 
-    if (read(STDIN_FILENO, &seq[0], 1) != 1)
+    if (!editor_input_sequence_byte(&seq[0]))
       return ESC;
-    if (read(STDIN_FILENO, &seq[1], 1) != 1)
+    if (!editor_input_sequence_byte(&seq[1]))
       return ESC;
 
     if (seq[0] == CSI) {
       if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1)
+        if (!editor_input_sequence_byte(&seq[2]))
           return ESC;
+        if (seq[1] == '2' && seq[2] == '0') {
+          // ESC [200~ starts a bracketed paste, ESC [201~ ends it and
+          // ESC [20~ is F9, which has nothing more to read
+          char mark[2];
+          if (!editor_input_sequence_byte(&mark[0]))
+            return ESC;
+          if (mark[0] != '0' && mark[0] != '1')
+            return 0;
+          if (!editor_input_sequence_byte(&mark[1]))
+            return ESC;
+          return mark[0] == '0' && mark[1] == '~' ? PASTE : 0;
+        }
         if (seq[2] == '~') {
           switch (seq[1]) {
           case '1':
@@ -865,8 +2260,9 @@ int editor_read_key() {
         int i = 0;
         unsigned char btn, x, y;
 
-        while (i < 9) {
-          if (read(STDIN_FILENO, &mouse_seq[i], 1) != 1)
+        // button, column and row, the keys after them stay buffered
+        while (i < 3) {
+          if (!editor_input_sequence_byte(&mouse_seq[i]))
             break;
           i++;
         }
@@ -955,59 +2351,84 @@ int editor_read_key() {
   }
 }
 
-void editor_move_cursor_to(unsigned char x, unsigned char y) {
-  if (y >= 0 && y + ec.rowOffset < ec.numRows) {
-    ec.cy = y + ec.rowOffset;
+static void editor_focus_window(editor_window *w);
+
+// a click at screen column sx of row sy moves the cursor there, in the window
+// clicked
+void editor_move_cursor_to(unsigned char sx, unsigned char sy) {
+  editor_window *w = editor_window_first(ec.windows);
+  while (w != NULL && (sy < w->top || sy >= w->top + w->rows ||
+                       sx < w->left || sx >= w->left + w->cols))
+    w = editor_window_next(w);
+  if (w == NULL)
+    return;
+  editor_focus_window(w);
+  int x = sx - w->left, y = sy - w->top;
+
+  if (y >= 0 && y + ec.win->rowOffset < ec.buf->numRows) {
+    ec.win->cy = y + ec.win->rowOffset;
   }
-  ec.cx = IMIN(x, ec.row[ec.cy].rsize);
+  editor_row *row = editor_row_at(ec.win->cy);
+  if (row != NULL)
+    editor_row_materialize_drawn(row);
+  ec.win->cx = row ? editor_row_rx_to_cx(row, ec.win->colOffset + x) : 0;
+}
+
+editor_row *editor_row_at(int at) {
+  return editor_row_tree_get(ec.buf->rows, at);
 }
 
 void editor_move_cursor(int key, int times) {
-  editor_row *row = ec.cy >= ec.numRows ? NULL : &ec.row[ec.cy];
+  editor_row *row = editor_row_at(ec.win->cy);
   while (times--) {
     switch (key) {
     case MOVE_CURSOR_UP:
-      if (ec.cy > 0) {
-        ec.cy--;
+      if (ec.win->cy > 0) {
+        ec.win->cy--;
       }
       break;
     case MOVE_CURSOR_DOWN:
-      if (ec.cy + 1 < ec.numRows) {
-        ec.cy++;
+      if (ec.win->cy + 1 < ec.buf->numRows) {
+        ec.win->cy++;
       }
       break;
     case MOVE_CURSOR_LEFT:
-      if (ec.cx > 0) {
-        ec.cx--;
-      } else if (ec.cy > 0) {
-        ec.cy--;
-        ec.cx = ec.row[ec.cy].size;
+      if (ec.win->cx > 0) {
+        ec.win->cx =
+            editor_row_prev_char(editor_row_at(ec.win->cy), ec.win->cx, 1);
+      } else if (ec.win->cy > 0) {
+        ec.win->cy--;
+        ec.win->cx = editor_row_at(ec.win->cy)->size;
       }
       break;
     case MOVE_CURSOR_RIGHT:
-      if (row && ec.cx < row->size) {
-        ec.cx++;
-      } else if (row && ec.cx == row->size) {
-        ec.cy++;
-        ec.cx = 0;
+      if (row && ec.win->cx < row->size) {
+        ec.win->cx = editor_row_next_char(row, ec.win->cx);
+      } else if (row && ec.win->cx == row->size) {
+        ec.win->cy++;
+        ec.win->cx = 0;
       }
       break;
     case MOVE_CURSOR_START:
     case HOME_KEY:
-      ec.cx = 0;
+      ec.win->cx = 0;
       break;
     case MOVE_CURSOR_END:
     case END_KEY:
-      ec.cx = ec.row[ec.cy].size;
+      ec.win->cx = row ? row->size : 0;
       break;
     }
   }
-  row = ec.cy > ec.numRows ? NULL : &ec.row[ec.cy];
+  row = editor_row_at(ec.win->cy);
 
   int rowLen = row ? row->size : 1;
-  if (ec.cx > rowLen) {
-    ec.cx = rowLen;
+  if (ec.win->cx > rowLen) {
+    ec.win->cx = rowLen;
   }
+  // on the start of a character, the row moved to may not have one where
+  // the cursor was
+  if (row != NULL && ec.win->cx < row->size)
+    ec.win->cx = editor_row_prev_char(row, ec.win->cx + 1, 1);
 }
 
 void editor_refresh_window_size() {
@@ -1018,33 +2439,281 @@ void editor_refresh_window_size() {
 }
 
 void editor_free_current_buffer() {
-  ec.cx = 0;
-  ec.cy = 0;
-  ec.rx = 0;
-  ec.numRows = 0;
-  ec.rowOffset = 0;
-  ec.colOffset = 0;
-  ec.dirty = 0;
-  if (ec.row != NULL && ec.numRows > 0) {
-    for (int i = 0; i < ec.numRows; i++) {
-      editor_free_row(&ec.row[i]);
-    }
-    free(ec.row);
+  // the save reads from the store
+  editor_save_done();
+  for (editor_row *row = editor_row_at(0); row;
+       row = editor_row_tree_next(row)) {
+    editor_free_row(row);
+  }
+  editor_row_tree_free(ec.buf->rows);
+  ec.buf->rows = NULL;
+  editor_text_store_free(&ec.buf->store);
+  editor_pager_close(ec.buf->pager);
+  ec.buf->pager = NULL;
+  editor_follow_stop(ec.buf->follow);
+  ec.buf->follow = NULL;
+  ec.buf->file_size = 0;
+  ec.win->page_top = 0;
+  ec.win->cx = 0;
+  ec.win->cy = 0;
+  ec.win->rx = 0;
+  ec.buf->numRows = 0;
+  ec.buf->hl_frontier = 0;
+  ec.buf->hl_checked = 0;
+  ec.buf->hl_drawn_ahead = 0;
+  ec.buf->rendered_rows = 0;
+  ec.buf->render_bytes = 0;
+  ec.buf->newest_render = NULL;
+  ec.buf->oldest_render = NULL;
+  ec.win->rowOffset = 0;
+  ec.win->colOffset = 0;
+  ec.buf->dirty = 0;
+  ec.buf->syntax = NULL;
+  if (ec.buf->filename != NULL)
+    free(ec.buf->filename);
+  ec.buf->filename = NULL;
+}
+
+// seconds after the last edit a named file gets saved, 0 to never
+static int editor_autosave_seconds;
+
+static void editor_autosave() {
+  // edits made during a save get saved once it is done
+  if (editor_save_running())
+    editor_loop_timer(editor_autosave_seconds * 1000, editor_autosave);
+  else if (ec.buf->dirty && ec.buf->filename != NULL)
+    editor_save_file(ec.buf->filename);
+}
+
+editor_buffer *editor_current_buffer() { return ec.buf; }
+
+// Bytes b holds: its text, its rows as if in full blocks, and the render and
+// hl of the rows drawn, kept up to date as they are built and dropped.
+static size_t editor_buffer_memory(editor_buffer *b) {
+  size_t blocks = (b->numRows + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE;
+  return b->store.orig_size + b->store.add_size +
+         blocks * sizeof(editor_row_block) + b->render_bytes;
+}
+
+static void editor_follow_poll();
+
+// the current buffer is about to be another one
+static void editor_leave_buffer(editor_buffer *next) {
+  // the autosave timer only looks at the current buffer
+  if (next != ec.buf && editor_autosave_seconds > 0 && ec.buf->dirty &&
+      ec.buf->filename != NULL)
+    editor_save_file(ec.buf->filename);
+}
+
+// the current buffer became ec.buf
+static void editor_enter_buffer() {
+  if (ec.buf->hl_frontier < ec.buf->hl_checked)
+    editor_loop_idle(editor_highlight_idle);
+  // lines appended while it was not current
+  if (ec.buf->follow != NULL)
+    editor_follow_poll();
+}
+
+// Show b in window w as it was left, its rows and highlight are kept and
+// the cursor goes back where the last window on it left it.
+static void editor_show_buffer(editor_window *w, editor_buffer *b) {
+  if (w->buf != NULL) {
+    w->buf->cx = w->cx;
+    w->buf->cy = w->cy;
+    w->buf->rowOffset = w->rowOffset;
+    w->buf->colOffset = w->colOffset;
+    w->buf->page_top = w->page_top;
+  }
+  w->buf = b;
+  w->cx = b->cx;
+  w->cy = b->cy;
+  w->rowOffset = b->rowOffset;
+  w->colOffset = b->colOffset;
+  w->page_top = b->page_top;
+  if (w == ec.win) {
+    ec.buf = b;
+    editor_enter_buffer();
+  }
+}
+
+// show b in the current window and tell which one it is
+static void editor_switch_buffer(editor_buffer *b) {
+  editor_leave_buffer(b);
+  editor_show_buffer(ec.win, b);
+
+  int n = 0, at = 0;
+  for (editor_buffer *o = ec.buffers; o != NULL; o = o->next) {
+    n++;
+    if (o == b)
+      at = n;
+  }
+  size_t bytes = editor_buffer_memory(b);
+  char size[24];
+  if (bytes < 1024 * 1024)
+    snprintf(size, sizeof(size), "%zu KB", (bytes + 1023) / 1024);
+  else
+    snprintf(size, sizeof(size), "%.1f MB", bytes / (1024.0 * 1024.0));
+  editor_set_status_msg("Buffer %d of %d: \"%s\" (%s)", at, n,
+                        b->filename ? b->filename : "[No Name]", size);
+}
+
+// Ctrl-N and Ctrl-P: show the next buffer, the previous one when direction
+// is negative
+void editor_next_buffer(int direction) {
+  editor_buffer *b = ec.buf->next != NULL ? ec.buf->next : ec.buffers;
+  if (direction < 0) {
+    b = ec.buffers;
+    while (b->next != NULL && b->next != ec.buf)
+      b = b->next;
+  }
+  if (b == ec.buf) {
+    editor_set_status_msg("No other buffer, Ctrl-O to open a file");
+    return;
+  }
+  editor_switch_buffer(b);
+}
+
+// Ctrl-W: close the buffer shown, the next one is shown instead. The last
+// one left is emptied.
+void editor_close_buffer() {
+  if (ec.buf->dirty && editor_confirm() != 1)
+    return;
+  editor_buffer *b = ec.buf;
+  if (ec.buffers == b && b->next == NULL) {
+    editor_free_current_buffer();
+    return;
+  }
+  editor_buffer *next = b->next;
+  if (next == NULL) {
+    next = ec.buffers;
+    while (next->next != b)
+      next = next->next;
+  }
+  editor_buffer_free(b);
+  for (editor_window *w = editor_window_first(ec.windows); w != NULL;
+       w = editor_window_next(w)) {
+    if (w->buf == NULL)
+      editor_show_buffer(w, next);
+  }
+  editor_set_status_msg("Showing \"%s\"",
+                        next->filename ? next->filename : "[No Name]");
+}
+
+// make w the current window
+static void editor_focus_window(editor_window *w) {
+  editor_leave_buffer(w->buf);
+  ec.win = w;
+  if (ec.buf != w->buf) {
+    ec.buf = w->buf;
+    editor_enter_buffer();
+  }
+}
+
+// split the current window in two on its buffer, side by side when
+// vertical, the cursor stays in the first one
+static void editor_split_window(int vertical) {
+  editor_window *w = ec.win;
+  if (vertical ? w->cols < 2 * WINDOW_MIN_COLS + 1
+               : w->rows + 1 < 2 * (WINDOW_MIN_ROWS + 1)) {
+    editor_set_status_msg("No room to split the window");
+    return;
+  }
+  editor_window *split = calloc(1, sizeof(editor_window));
+  editor_window *other = malloc(sizeof(editor_window));
+  *other = *w;
+  split->parent = w->parent;
+  if (w->parent == NULL)
+    ec.windows = split;
+  else if (w->parent->first == w)
+    w->parent->first = split;
+  else
+    w->parent->second = split;
+  split->first = w;
+  split->second = other;
+  split->vertical = vertical;
+  w->parent = split;
+  other->parent = split;
+  // the windows moved, nothing on screen is where it was
+  editor_screen_invalidate(&ec.screen);
+}
+
+// close the current window, the one next to it takes its area
+static void editor_close_window() {
+  editor_window *w = ec.win;
+  editor_window *split = w->parent;
+  if (split == NULL) {
+    editor_set_status_msg("Only one window");
+    return;
+  }
+  editor_window *other = split->first == w ? split->second : split->first;
+  other->parent = split->parent;
+  if (split->parent == NULL)
+    ec.windows = other;
+  else if (split->parent->first == split)
+    split->parent->first = other;
+  else
+    split->parent->second = other;
+  // the buffer keeps where the window was
+  w->buf->cx = w->cx;
+  w->buf->cy = w->cy;
+  w->buf->rowOffset = w->rowOffset;
+  w->buf->colOffset = w->colOffset;
+  w->buf->page_top = w->page_top;
+  free(split);
+  free(w);
+  // ec.win is gone, nothing is left to autosave from
+  ec.win = editor_window_first(other);
+  ec.buf = ec.win->buf;
+  editor_enter_buffer();
+  editor_screen_invalidate(&ec.screen);
+}
+
+// Ctrl-X and a key: 2 splits the window in two one above the other, 3 side
+// by side, o goes to the next window and 0 closes the window
+void editor_window_command() {
+  editor_set_status_msg("Window: 2 split, 3 split side by side, o other, "
+                        "0 close");
+  int c;
+  do {
+    if (!editor_input_pending())
+      editor_refresh_screen();
+    c = editor_read_key();
+  } while (c == 0 || c == REDRAW || c == SEARCH_PROGRESS);
+  editor_set_status_msg("");
+
+  editor_window *next;
+  switch (c) {
+  case '2':
+  case '3':
+    editor_split_window(c == '3');
+    break;
+  case 'o':
+  case CTRL_KEY('x'):
+    next = editor_window_next(ec.win);
+    editor_focus_window(next != NULL ? next : editor_window_first(ec.windows));
+    break;
+  case '0':
+    editor_close_window();
+    break;
   }
-  ec.row = NULL;
-  ec.statusmsg[0] = '\0';
-  ec.statusmsg_time = 0;
-  ec.syntax = NULL;
-  if (ec.filename != NULL)
-    free(ec.filename);
 }
 
 void editor_init() {
   term_init();
   term_enable_raw_mode();
   term_enable_mouse_reporting();
-  editor_free_current_buffer();
+  // pastes come as one PASTE rather than as typed keys
+  if (write(STDOUT_FILENO, "\x1b[?2004h", 8) != 8)
+    DEBUG_PRINT("Error: editor_init couldn't enable bracketed paste");
+  editor_loop_init();
+  ec.buf = editor_buffer_new();
   editor_refresh_window_size();
+  const char *autosave = getenv("DICTEE_AUTOSAVE");
+  if (autosave != NULL)
+    editor_autosave_seconds = atoi(autosave);
+  const char *pager = getenv("DICTEE_PAGER_MB");
+  editor_pager_min_bytes =
+      (size_t)(pager != NULL ? atol(pager) : PAGER_MIN_MB) * 1024 * 1024;
   editor_init_screen();
   editor_set_status_msg("Hit Ctrl-Q to quit & Ctrl-Q to save");
 }
@@ -1061,30 +2730,315 @@ void editor_init_screen() {
 
 void editor_paste() {
   char *t = clipboard_read();
-  int len = str_len(t);
-  int i = 0;
-
-  while (i < len) {
-    editor_insert_char(t[i]);
-    i++;
-  }
-  ec.dirty++;
+  editor_insert_text(t, str_len(t));
 }
 
 void editor_exit() {
-  editor_free_current_buffer();
+  while (ec.buffers != NULL) {
+    ec.buf = ec.buffers;
+    editor_buffer_free(ec.buf);
+  }
+  if (write(STDOUT_FILENO, "\x1b[?2004l", 8) != 8)
+    DEBUG_PRINT("Error: editor_exit couldn't disable bracketed paste");
   term_disable_mouse_reporting();
   term_clean();
   term_move_cursor_to_origin();
   exit(0);
 }
 
+// a followed file that is not the one read anymore is opened again, unless
+// that would lose edits
+static void editor_follow_reopen() {
+  if (ec.buf->dirty) {
+    editor_follow_stop(ec.buf->follow);
+    ec.buf->follow = NULL;
+    editor_set_status_msg("\"%s\" was truncated or replaced, not following",
+                          ec.buf->filename);
+    return;
+  }
+  char *filename = strdup(ec.buf->filename);
+  editor_follow_stop(ec.buf->follow);
+  ec.buf->follow = NULL;
+  editor_load_file(filename);
+  editor_follow_toggle();
+  free(filename);
+}
+
+// Add what was appended to the followed file to the end of the buffer. The
+// cursor stays on the last row if it was there.
+void editor_follow_update() {
+  // the search and the save read the rows, they grow once they are done
+  if (ec.buf->follow == NULL || editor_match_index_fd() != -1 ||
+      editor_save_running())
+    return;
+  char *text;
+  long len = editor_follow_read(ec.buf->follow, &text);
+  if (len == -1)
+    editor_follow_reopen();
+  if (len <= 0)
+    return;
+
+  int bottom = ec.win->cy >= ec.buf->numRows - 1;
+  int cx = ec.win->cx, cy = ec.win->cy, dirty = ec.buf->dirty;
+  ec.win->cy = ec.buf->numRows - 1;
+  ec.win->cx = editor_row_at(ec.win->cy)->size;
+  editor_insert_file_text(text, len);
+  free(text);
+  // the buffer still holds the file
+  ec.buf->dirty = dirty;
+  ec.win->cx = bottom ? 0 : cx;
+  ec.win->cy = bottom ? ec.buf->numRows - 1 : cy;
+}
+
+// a followed file without inotify is looked at on a timer, while its buffer
+// is shown
+static void editor_follow_poll() {
+  editor_follow_update();
+  if (ec.buf->follow != NULL && editor_follow_fd(ec.buf->follow) == -1)
+    editor_loop_timer(FOLLOW_POLL_MS, editor_follow_poll);
+}
+
+// Ctrl-T: follow the file as it grows, or stop
+void editor_follow_toggle() {
+  if (ec.buf->follow != NULL) {
+    ec.buf->file_size = editor_follow_stop(ec.buf->follow);
+    ec.buf->follow = NULL;
+    editor_set_status_msg("Stopped following \"%s\"", ec.buf->filename);
+    return;
+  }
+  if (ec.buf->filename == NULL) {
+    editor_set_status_msg("Save the file first to follow it");
+    return;
+  }
+  ec.buf->follow = editor_follow_start(ec.buf->filename, ec.buf->file_size);
+  if (ec.buf->follow == NULL) {
+    editor_set_status_msg("Error: cannot follow \"%s\": %s", ec.buf->filename,
+                          strerror(errno));
+    return;
+  }
+  // lines show up at the bottom
+  ec.win->cy = ec.buf->numRows - 1;
+  ec.win->cx = 0;
+  editor_set_status_msg("Following \"%s\", Ctrl-T to stop", ec.buf->filename);
+  editor_follow_poll();
+}
+
+// Ctrl-G: move to a line by its number
+static void editor_goto_line() {
+  char *answer = editor_prompt("Go to line: %s (ESC to cancel)", NULL);
+  if (answer == NULL)
+    return;
+  long line = atol(answer);
+  free(answer);
+  if (line < 1) {
+    editor_set_status_msg("Not a line number");
+    return;
+  }
+  if (ec.buf->pager == NULL) {
+    editor_match m = {IMIN(line, ec.buf->numRows) - 1, 0, 0};
+    editor_search_jump(&m);
+    return;
+  }
+
+  int done;
+  if (editor_pager_lines(ec.buf->pager, &done) < line && !done) {
+    editor_set_status_msg("Counting lines up to %ld...", line);
+    editor_refresh_screen();
+  }
+  // waits for the pager to count that far
+  size_t at;
+  if (!editor_pager_line_offset(ec.buf->pager, line - 1, &at)) {
+    editor_set_status_msg("Line %ld is past the end of the file", line);
+    return;
+  }
+  ec.win->page_top = at;
+  ec.win->colOffset = 0;
+}
+
+// offset of the line n lines below the one starting at at, above it when n
+// is negative, as far as the file goes. *moved is set to how many it went.
+static size_t editor_page_lines_from(size_t at, int n, int *moved) {
+  size_t size;
+  editor_pager_text(ec.buf->pager, &size);
+  int count = 0;
+  for (; n > 0; n--, count++) {
+    size_t next = editor_pager_next_line(ec.buf->pager, at);
+    if (next >= size)
+      break;
+    at = next;
+  }
+  for (; n < 0 && at > 0; n++, count--)
+    at = editor_pager_line_start(ec.buf->pager, at - 1);
+  if (moved != NULL)
+    *moved = count;
+  return at;
+}
+
+// move the view n lines down, up when n is negative
+static void editor_page_scroll(int n) {
+  int moved;
+  ec.win->page_top = editor_page_lines_from(ec.win->page_top, n, &moved);
+  // the terminal scrolls the rows that stay on screen
+  ec.win->rowOffset += moved;
+  ec.win->cy = ec.win->rowOffset;
+}
+
+// Look for the last query from the top line on when direction is 0, after it
+// when 1 and before it when -1. The line of the match becomes the top one.
+static void editor_page_find(int direction) {
+  if (editor_page_query == NULL) {
+    editor_set_status_msg("Nothing to look for, Ctrl-F to search");
+    return;
+  }
+  editor_search *s = &editor_page_search;
+  editor_set_status_msg("Searching \"%s\"...", editor_page_query);
+  editor_refresh_screen();
+  long found;
+  size_t from = ec.win->page_top;
+  if (direction < 0)
+    found = editor_pager_search_backward(ec.buf->pager, s, from);
+  else
+    found = editor_pager_search_forward(
+        ec.buf->pager, s,
+        direction == 0 ? from : editor_pager_next_line(ec.buf->pager, from));
+  if (found == -1) {
+    editor_set_status_msg("\"%s\" not found %s", editor_page_query,
+                          direction < 0 ? "above" : "below");
+    return;
+  }
+  editor_set_status_msg("");
+
+  size_t size;
+  const char *text = editor_pager_text(ec.buf->pager, &size);
+  ec.win->page_top = editor_pager_line_start(ec.buf->pager, found);
+  // bring the match into view when it is off to a side
+  int rx = editor_page_rx(text, ec.win->page_top, found);
+  if (rx < ec.win->colOffset ||
+      rx + s->len > ec.win->colOffset + ec.win->cols)
+    ec.win->colOffset =
+        rx + s->len <= ec.win->cols ? 0 : rx - ec.win->cols / 2;
+}
+
+static void editor_page_search_callback(char *query, int c) {
+  (void)query;
+  if (c == CTRL_KEY('t'))
+    editor_page_ignore_case = !editor_page_ignore_case;
+}
+
+static void editor_page_find_prompt() {
+  char *query = editor_prompt(
+      "Search: %s (ESC to cancel/Ctrl-T to ignore case/then n or N)",
+      editor_page_search_callback);
+  if (query == NULL || query[0] == '\0') {
+    free(query);
+    return;
+  }
+  free(editor_page_query);
+  editor_page_query = query;
+  editor_search_init(&editor_page_search, editor_page_query,
+                     editor_page_ignore_case);
+  editor_page_find(0);
+}
+
+// keys of the paging mode, the file can only be looked at
+static void editor_page_keypress(int c) {
+  size_t size;
+  switch (c) {
+  case 0:
+  case ESC:
+  case REDRAW:
+    break;
+  case CTRL_KEY('q'):
+    if (editor_confirm() == 1)
+      editor_exit();
+    break;
+  case CTRL_KEY('o'):
+    editor_open();
+    break;
+  case CTRL_KEY('n'):
+  case CTRL_KEY('p'):
+    editor_next_buffer(c == CTRL_KEY('n') ? 1 : -1);
+    break;
+  case CTRL_KEY('w'):
+    editor_close_buffer();
+    break;
+  case CTRL_KEY('x'):
+    editor_window_command();
+    break;
+  case CTRL_KEY('f'):
+    editor_page_find_prompt();
+    break;
+  case 'n':
+  case 'N':
+    editor_page_find(c == 'n' ? 1 : -1);
+    break;
+  case CTRL_KEY('g'):
+    editor_goto_line();
+    break;
+  case MOVE_CURSOR_UP:
+  case MOUSE_SCROLL_UP:
+    editor_page_scroll(-1);
+    break;
+  case MOVE_CURSOR_DOWN:
+  case MOUSE_SCROLL_DOWN:
+    editor_page_scroll(1);
+    break;
+  case PAGE_UP:
+    editor_page_scroll(-ec.win->rows);
+    break;
+  case PAGE_DOWN:
+    editor_page_scroll(ec.win->rows);
+    break;
+  case MOVE_CURSOR_LEFT:
+    if (ec.win->colOffset > 0)
+      ec.win->colOffset--;
+    break;
+  case MOVE_CURSOR_RIGHT:
+    ec.win->colOffset++;
+    break;
+  case HOME_KEY:
+    ec.win->page_top = 0;
+    ec.win->colOffset = 0;
+    break;
+  case END_KEY:
+    // the last page
+    editor_pager_text(ec.buf->pager, &size);
+    ec.win->page_top = editor_page_lines_from(
+        editor_pager_line_start(ec.buf->pager, size > 0 ? size - 1 : 0),
+        1 - ec.win->rows, NULL);
+    ec.win->colOffset = 0;
+    break;
+  case PASTE: {
+    // the pasted text is dropped
+    size_t len;
+    free(editor_input_paste(&len));
+    editor_set_status_msg("Read only: the file is too big to edit");
+    break;
+  }
+  default:
+    editor_set_status_msg("Read only: the file is too big to edit");
+    break;
+  }
+}
+
 void editor_process_keypress() {
+  // edits made by the last key restart the autosave timer
+  static int last_dirty;
+  if (editor_autosave_seconds > 0 && ec.buf->dirty &&
+      ec.buf->dirty != last_dirty)
+    editor_loop_timer(editor_autosave_seconds * 1000, editor_autosave);
+  last_dirty = ec.buf->dirty;
+
   int c = editor_read_key();
   /* editor_set_status_msg("Key %02x pressed", c); */
+  if (ec.buf->pager != NULL) {
+    editor_page_keypress(c);
+    return;
+  }
   switch (c) {
   case 0:
   case ESC:
+  case REDRAW:
     break;
   case TAB:
     for (int i = 0; i < TAB_SIZE; i++) {
@@ -1098,15 +3052,40 @@ void editor_process_keypress() {
     editor_set_status_msg("TODO: clipboard windows/linux");
 #endif
     break;
+  case PASTE: {
+    size_t len;
+    char *text = editor_input_paste(&len);
+    editor_insert_text(text, len);
+    free(text);
+    break;
+  }
   case CTRL_KEY('o'):
     editor_open();
     break;
+  case CTRL_KEY('n'):
+  case CTRL_KEY('p'):
+    editor_next_buffer(c == CTRL_KEY('n') ? 1 : -1);
+    break;
+  case CTRL_KEY('w'):
+    editor_close_buffer();
+    break;
+  case CTRL_KEY('x'):
+    editor_window_command();
+    break;
   case CTRL_KEY('f'):
     editor_find();
+    // lines appended while searching
+    editor_follow_update();
+    break;
+  case CTRL_KEY('t'):
+    editor_follow_toggle();
     break;
   case CTRL_KEY('s'):
     editor_save();
     break;
+  case CTRL_KEY('g'):
+    editor_goto_line();
+    break;
   case CTRL_KEY('c'):
     // TODO:
     // select all
@@ -1147,11 +3126,11 @@ void editor_process_keypress() {
     editor_move_cursor(MOVE_CURSOR_START, 1);
     break;
   case PAGE_UP: {
-    editor_move_cursor(MOVE_CURSOR_UP, ec.screenRows);
+    editor_move_cursor(MOVE_CURSOR_UP, ec.win->rows);
     break;
   }
   case PAGE_DOWN: {
-    editor_move_cursor(MOVE_CURSOR_DOWN, ec.rowOffset + ec.screenRows - 1);
+    editor_move_cursor(MOVE_CURSOR_DOWN, ec.win->rowOffset + ec.win->rows - 1);
     break;
   }
   case MOUSE_SCROLL_UP: {
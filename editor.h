@@ -1,5 +1,9 @@
 #ifndef _EDITOR_H_
 #define _EDITOR_H_
+// -std=c99 hides posix apis like strdup and clock_gettime
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
@@ -8,6 +12,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 // TODO:
 // - windows & linux compat
@@ -19,6 +26,26 @@
 
 #define TAB_SIZE 2
 #define SCROLL_OFFSET 4
+// rows keeping their render/hl before off screen ones get dropped
+#define RENDER_CACHE_ROWS 4096
+// rows lexed per idle step while edits left some behind the frontier
+#define HL_IDLE_ROWS 512
+// rows per thread when highlighting a file as it is opened
+#define HL_PARALLEL_MIN_ROWS 16384
+#define HL_PARALLEL_MAX_THREADS 64
+// seconds a status message stays up
+#define STATUS_MSG_SECONDS 5
+// ms between two updates of the progress of a save
+#define SAVE_PROGRESS_MS 100
+// ms between two looks at a followed file when inotify is not there
+#define FOLLOW_POLL_MS 250
+// files this big open read only in paging mode, see pager.c
+#define PAGER_MIN_MB 1024
+// smallest text area a split leaves a window
+#define WINDOW_MIN_ROWS 2
+#define WINDOW_MIN_COLS 16
+// search matches highlighted on one row
+#define MAX_ROW_MATCHES 256
 
 enum editor_keys {
   TAB = 9,
@@ -37,8 +64,18 @@ enum editor_keys {
   PAGE_DOWN,
   MOUSE_SCROLL_UP,
   MOUSE_SCROLL_DOWN,
+  // not a key: the search index found more matches
+  SEARCH_PROGRESS,
+  // not a key: the window was resized or a timer fired, draw again
+  REDRAW,
+  // not a key: a bracketed paste starts, see editor_input_paste
+  PASTE,
 };
 
+// hl_open_comment of a row inserted but not lexed yet, it never matches the
+// state lexing finds, so the frontier does not stop converging at it
+#define HL_NOT_LEXED -1
+
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 #define HL_HIGHLIGHT_COMMENT (1<<2)
@@ -54,6 +91,22 @@ enum editor_highlight {
   HL_SEARCH_RESULT,
 };
 
+// byte classes of a compiled syntax
+#define CHAR_SEPARATOR (1<<0)
+#define CHAR_SPACE (1<<1)
+#define CHAR_DIGIT (1<<2)
+#define CHAR_QUOTE (1<<3)
+// first byte of a comment delimiter
+#define CHAR_COMMENT (1<<4)
+// none of separator, quote or comment: part of a word
+#define CHAR_WORD (1<<5)
+
+typedef struct {
+  const char *word;
+  int len;
+  unsigned char hl;
+} editor_keyword;
+
 typedef struct {
   char* filetype;
   char** filematches;
@@ -62,17 +115,136 @@ typedef struct {
   char* multiline_comment_end;
   char** keywords;
   int flags;
+  // filled in by editor_syntax_compile, see syntax.c
+  unsigned char classes[256];
+  editor_keyword *keyword_table;
+  unsigned int keyword_mask;
+  unsigned int keyword_seed;
+  int slc_len;
+  int mlcs_len;
+  int mlce_len;
 } editor_syntax;
 
+#define ROW_BLOCK_SIZE 64
+// chars between two column marks of a long row
+#define COL_MARK_STEP 256
+
+// where a char of a row is drawn, see the column marks in editor.c
+typedef struct {
+  int cx;
+  // display column and offset in render
+  int rx, ri;
+} editor_col_mark;
+
 typedef struct {
-  int index;
+  int count, cap;
+  editor_col_mark at[];
+} editor_col_marks;
+
+// render[start, start + len) lexed as class hl, see the highlight spans in
+// editor.c
+typedef struct {
+  int start, len;
+  unsigned char hl;
+} editor_hl_span;
+
+typedef struct editor_row editor_row;
+
+// What a row holds once it is drawn or edited, the rows of a file only
+// looked at keep none. Dropped and built again as rows go off and on screen.
+typedef struct editor_row_render {
+  // number of tabs in the row text
+  int tabs;
+  // bytes of the text past ASCII, with tabs they make columns differ from
+  // bytes
+  int nonascii;
+  // the text as drawn, tabs expanded, and its allocated size
+  char *text;
+  int size;
+  int cap;
+  // highlight of text, the bytes in no span are HL_DEFAULT
+  editor_hl_span *hl;
+  int hl_count, hl_cap;
+  // marks of a long row, NULL until it is looked up
+  editor_col_marks *marks;
+  // the row it belongs to, kept up to date as rows move between blocks
+  editor_row *row;
+  // renders of the buffer from the last used to the least recently used
+  struct editor_row_render *newer, *older;
+} editor_row_render;
+
+typedef struct editor_row_block editor_row_block;
+
+// A row is a view into the text store plus what it needs in a file that is
+// only read: its gap and the comment state. The rest goes in render, built
+// for the rows drawn or edited.
+struct editor_row {
+  // block holding the row, its index is derived from it
+  editor_row_block *block;
+  // view into the text store, not owned by the row
+  // text is chars[0, gap_at) followed by
+  // chars[gap_at + gap_len, size + gap_len)
   char *chars;
   int size;
-  char *render;
-  int rsize;
-  unsigned char* hl;
+  int gap_at;
+  int gap_len;
   int hl_open_comment;
-} editor_row;
+  // NULL until the row is drawn or edited
+  editor_row_render *render;
+};
+
+// node of the row tree, see row_tree.c
+struct editor_row_block {
+  editor_row_block *left, *right, *parent;
+  unsigned int priority;
+  // rows in this block
+  int count;
+  // rows in this subtree
+  int total;
+  editor_row rows[ROW_BLOCK_SIZE];
+};
+
+typedef struct editor_add_chunk {
+  struct editor_add_chunk *next;
+  size_t size;
+  size_t used;
+  char data[];
+} editor_add_chunk;
+
+// piece table backing the rows, see text_store.c
+typedef struct {
+  // whole file as loaded by editor_open_file, read only
+  char *orig;
+  size_t orig_size;
+  // append-only add buffer, newest chunk first
+  editor_add_chunk *add;
+  size_t add_size;
+  // a save reads a snapshot, add buffer bytes up to frozen_used of
+  // frozen_chunk and in older chunks are not changed in place
+  int frozen;
+  editor_add_chunk *frozen_chunk;
+  size_t frozen_used;
+} editor_text_store;
+
+// compiled search needle, see search.c
+typedef struct {
+  const char *needle;
+  int len;
+  int ignore_case;
+  // bytes probed first and last, or'ed with their fold bit
+  unsigned char first, last;
+  // 0x20 for a letter when ignoring case, 0 otherwise
+  unsigned char first_fold, last_fold;
+} editor_search;
+
+// compiled regular expression, see regex.c
+typedef struct editor_regex editor_regex;
+
+typedef struct {
+  int row;
+  int at;
+  int len;
+} editor_match;
 
 typedef struct {
   int cx, cy;
@@ -80,30 +252,120 @@ typedef struct {
   int colOffset;
 } editor_cursor_position;
 
-//TODO extract buffer/file stuff
-//to be able to support multiple files
+// sgr color of a cell, or'ed with SCREEN_INVERSE for reverse video
+#define SCREEN_DEFAULT 39
+#define SCREEN_INVERSE 0x80
+
+// a cell of the screen, see screen.c
+// bytes a cell holds, a character and the combining marks on it
+#define SCREEN_CELL_BYTES 7
+
+// a cell holds the UTF-8 text drawn in it, padded with NULs, the cell right
+// of a wide character holds none
+typedef struct {
+  char ch[SCREEN_CELL_BYTES];
+  unsigned char attr;
+} editor_cell;
+
 typedef struct {
+  int rows, cols;
+  // frame being drawn and what the terminal shows, rows * cols cells each
+  editor_cell *back, *front;
+  // front is not known, the next flush repaints everything
+  int invalid;
+  int cursor_y, cursor_x;
+  int cursor_hidden;
+} editor_screen;
+
+// read only mapping of a file, see pager.c
+typedef struct editor_pager editor_pager;
+// watch on a growing file, see follow.c
+typedef struct editor_follow editor_follow;
+
+// a file open in the editor, see the buffer list in editor.c
+typedef struct editor_buffer {
+  // where the last window showing it left the cursor and the view
   int cx, cy;
-  int rx, ry;
-  int screenCols;
-  int screenRows;
-  int numRows;
   int rowOffset;
   int colOffset;
-  editor_row *row;
+  size_t page_top;
+  int numRows;
+  // rows before it have a known hl_open_comment
+  int hl_frontier;
+  // rows in [hl_frontier, hl_checked) were lexed in order after the state
+  // they were lexed with changed, they hold again once the state converges
+  int hl_checked;
+  // one past the last row drawn past hl_frontier, 0 with none. Those rows
+  // are lexed with the state the row before holds until the frontier gets
+  // there.
+  int hl_drawn_ahead;
+  // rows with render/hl built and the bytes they take
+  int rendered_rows;
+  size_t render_bytes;
+  // ends of the list of rendered rows, the cache is trimmed from the oldest
+  editor_row_render *newest_render, *oldest_render;
+  editor_row_block *rows;
+  editor_text_store store;
+  // paging mode when not NULL, windows show it from page_top on
+  editor_pager *pager;
+  // not NULL while following the file
+  editor_follow *follow;
+  // size of the file when it was last read or saved
+  off_t file_size;
   int dirty;
   char *filename;
+  editor_syntax *syntax;
+  struct editor_buffer *next;
+} editor_buffer;
+
+// Node of the window layout, see editor.c. A leaf is a window showing a
+// buffer, any other node splits its area between first and second.
+typedef struct editor_window {
+  struct editor_window *parent, *first, *second;
+  // second is right of first rather than below it
+  int vertical;
+
+  editor_buffer *buf;
+  int cx, cy;
+  int rx;
+  int rowOffset;
+  int colOffset;
+  // first line shown in paging mode
+  size_t page_top;
+  // text area on the screen, its status bar is the row below
+  int top, left;
+  int rows, cols;
+  // view the terminal shows, rows it moved over are scrolled
+  editor_buffer *drawn_buf;
+  int drawn_row, drawn_col;
+} editor_window;
+
+typedef struct {
+  int screenCols;
+  int screenRows;
+  // open buffers in the order they were opened, buf is the one shown in the
+  // current window win, windows is the root of the layout
+  editor_buffer *buffers;
+  editor_buffer *buf;
+  editor_window *windows;
+  editor_window *win;
   char statusmsg[80];
   time_t statusmsg_time;
-  editor_syntax *syntax;
+  editor_screen screen;
 } editor_config;
 
+// char at position at of the row text, skipping the gap
+static inline char editor_row_char(editor_row *row, int at) {
+  return row->chars[at < row->gap_at ? at : at + row->gap_len];
+}
+
 void editor_init();
 void editor_init_screen();
 void editor_open();
 void editor_open_file(char *filename);
+void editor_bench_highlight(char *filename, int nthreads);
 void editor_save();
-int editor_save_file(const char *filename, char *buffer, ssize_t len);
+void editor_save_file(const char *filename);
 void editor_delete_char();
 void editor_refresh_screen();
 void editor_refresh_window_size();
@@ -111,6 +373,10 @@ void editor_process_keypress();
 void editor_paste();
 void editor_exit();
 void editor_free_current_buffer();
+editor_buffer *editor_current_buffer();
+void editor_next_buffer(int direction);
+void editor_close_buffer();
+void editor_window_command();
 char *editor_prompt(char *prompt, void (*callback)(char *, int));
 int editor_confirm();
 void editor_set_status_msg(const char *fmt, ...);
@@ -122,17 +388,138 @@ void editor_update_syntax();
 void editor_row_update_syntax(editor_row *row);
 int editor_syntax_to_color(int hl);
 void editor_update_row(editor_row *row);
+void editor_row_materialize(editor_row *row);
+void editor_row_drop_render(editor_row *row);
+void editor_update_row_span(editor_row *row, int at, const char *removed,
+                            int removed_len, int inserted);
 void editor_insert_row(int at, char *line, int linelen);
 void editor_delete_row(int at);
 void editor_row_delete_char(editor_row *row, int at);
 void editor_insert_char(int c);
+void editor_insert_text(const char *text, size_t len);
+void editor_insert_file_text(const char *text, size_t len);
 void editor_row_insert_char(editor_row *row, int at, int c);
 void editor_row_append_string(editor_row *row, const char *s, size_t len);
-char *editor_rows_to_string(size_t *len);
 int editor_row_cx_to_rx(editor_row *row, int cx);
 int editor_row_rx_to_cx(editor_row *row, int rx);
 void editor_free_row(editor_row *row);
-void editor_move_cursor_to(unsigned char x, unsigned char y);
+size_t editor_count_lines(const char *buf, size_t len);
+void editor_move_cursor_to(unsigned char sx, unsigned char sy);
 void editor_move_cursor(int key, int times);
+editor_row *editor_row_at(int at);
+
+editor_row_block *editor_row_tree_build(int numrows);
+void editor_row_tree_free(editor_row_block *root);
+editor_row *editor_row_tree_get(editor_row_block *root, int at);
+int editor_row_tree_index(editor_row *row);
+editor_row *editor_row_tree_next(editor_row *row);
+editor_row *editor_row_tree_prev(editor_row *row);
+editor_row *editor_row_tree_insert(editor_row_block **root, int at);
+editor_row *editor_row_tree_insert_rows(editor_row_block **root, int at,
+                                        int count);
+void editor_row_tree_delete(editor_row_block **root, int at);
+
+void editor_text_store_init(editor_text_store *ts, char *orig, size_t len);
+void editor_text_store_free(editor_text_store *ts);
+char *editor_text_store_append(editor_text_store *ts, const char *s,
+                               size_t len);
+void editor_text_store_reserve(editor_text_store *ts, editor_row *row,
+                               size_t extra);
+void editor_text_store_truncate(editor_text_store *ts, editor_row *row,
+                                int len);
+void editor_row_move_gap(editor_row *row, int at);
+int editor_row_find_char(editor_row *row, int from, char c);
+void editor_row_copy(editor_row *row, int from, int to, char *dst);
+int editor_text_store_follows(editor_text_store *ts, editor_row *row,
+                              editor_row *next);
+void editor_text_store_thaw(editor_text_store *ts, editor_row *row);
+struct iovec *editor_text_store_snapshot(editor_text_store *ts,
+                                         editor_row *first, int *count,
+                                         size_t *total);
+void editor_text_store_release(editor_text_store *ts, struct iovec *pieces);
+
+int editor_utf8_decode(const char *s, int len, int *cp);
+int editor_utf8_width(int cp);
+int editor_utf8_ascii(const char *s, int len);
+int editor_utf8_count(const char *s, int len);
+int editor_utf8_columns(const char *s, int len, int col);
+
+void editor_search_init(editor_search *s, const char *needle, int ignore_case);
+long editor_search_buf(editor_search *s, const char *hay, size_t n);
+int editor_row_search(editor_search *s, editor_row *row, int from);
+int editor_row_match_at(editor_search *s, editor_row *row, int at);
+editor_row *editor_search_rows(editor_search *s, editor_text_store *ts,
+                               editor_row *row, int count, int *at);
+editor_regex *editor_regex_compile(const char *pattern, int ignore_case,
+                                   const char **error);
+void editor_regex_free(editor_regex *re);
+const char *editor_regex_literal(editor_regex *re);
+int editor_regex_row_search(editor_regex *re, editor_row *row, int from,
+                            int *len);
+void editor_match_index_start(const char *query, int ignore_case, int regex,
+                              editor_text_store *ts, editor_row_block *rows,
+                              int numrows);
+void editor_match_index_clear();
+int editor_match_index_fd();
+void editor_match_index_drain();
+int editor_match_index_step(int direction, editor_match *m);
+int editor_match_index_status(int *k, int *n, int *done);
+int editor_match_index_row(int row, editor_match *out, int max);
+const char *editor_match_index_error();
+
+void editor_save_start(const char *filename, editor_text_store *ts,
+                       editor_row *first);
+int editor_save_running();
+int editor_save_progress(size_t *written, size_t *total);
+long editor_save_finish();
+
+editor_pager *editor_pager_open(int fd, size_t size);
+void editor_pager_close(editor_pager *p);
+const char *editor_pager_text(editor_pager *p, size_t *size);
+int editor_pager_fd(editor_pager *p);
+void editor_pager_drain(editor_pager *p);
+long editor_pager_lines(editor_pager *p, int *done);
+int editor_pager_line_offset(editor_pager *p, long line, size_t *offset);
+long editor_pager_line_number(editor_pager *p, size_t offset);
+size_t editor_pager_next_line(editor_pager *p, size_t at);
+size_t editor_pager_line_start(editor_pager *p, size_t at);
+long editor_pager_search_forward(editor_pager *p, editor_search *s,
+                                 size_t from);
+long editor_pager_search_backward(editor_pager *p, editor_search *s,
+                                  size_t from);
+
+editor_follow *editor_follow_start(const char *filename, off_t pos);
+off_t editor_follow_stop(editor_follow *fl);
+int editor_follow_fd(editor_follow *fl);
+void editor_follow_drain(editor_follow *fl);
+long editor_follow_read(editor_follow *fl, char **text);
+void editor_follow_update();
+void editor_follow_toggle();
+
+void editor_loop_init();
+void editor_loop_timer(int ms, void (*fired)());
+void editor_loop_idle(int (*task)());
+void editor_loop_redraw();
+int editor_loop_wait();
+
+int editor_input_byte(char *c, int timeout);
+int editor_input_sequence_byte(char *c);
+int editor_input_pending();
+char *editor_input_paste(size_t *len);
+
+void editor_screen_resize(editor_screen *s, int rows, int cols);
+void editor_screen_invalidate(editor_screen *s);
+void editor_screen_free(editor_screen *s);
+void editor_screen_clear(editor_screen *s);
+int editor_screen_put(editor_screen *s, int y, int x, const char *text,
+                      int len, unsigned char attr);
+void editor_screen_scroll(editor_screen *s, buffer *ab, int top, int bottom,
+                          int n);
+int editor_screen_flush(editor_screen *s, buffer *ab, int y, int x);
+
+void editor_syntax_init();
+void editor_syntax_compile(editor_syntax *s);
+editor_syntax *editor_syntax_for_file(const char *filename);
+int editor_syntax_keyword(editor_syntax *s, const char *word, int len);
 
 #endif
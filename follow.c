@@ -0,0 +1,148 @@
+#include "editor.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Follow mode for files that keep growing, like logs.
+// The file is watched with inotify on linux, elsewhere or when inotify is
+// out of watches the editor looks at it on a timer. Only the bytes appended
+// since the last look are read, the editor adds them to the end of the
+// buffer following the file. A file that shrank or is not the same file
+// anymore, after a log rotation say, is reported so the editor can open it
+// again.
+
+struct editor_follow {
+  char *filename;
+  // the file as it was opened, read from pos on
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  off_t pos;
+  // the text read so far ends with a line break
+  int ended_line;
+  // inotify instance, -1 without
+  int watch;
+};
+
+// Follow filename from its first pos bytes on, the ones already in the
+// buffer. Returns NULL with errno set when it cannot be read.
+editor_follow *editor_follow_start(const char *filename, off_t pos) {
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &st) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return NULL;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  char last = '\n';
+  if (pos > 0 && pread(fd, &last, 1, pos - 1) != 1)
+    last = 0;
+  editor_follow *fl = malloc(sizeof(editor_follow));
+  fl->filename = strdup(filename);
+  fl->fd = fd;
+  fl->dev = st.st_dev;
+  fl->ino = st.st_ino;
+  fl->pos = pos;
+  // the empty row of an empty file is open for the first line
+  fl->ended_line = pos > 0 && last == '\n';
+
+  fl->watch = -1;
+#ifdef __linux__
+  fl->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fl->watch != -1 &&
+      inotify_add_watch(fl->watch, filename,
+                        IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                            IN_DELETE_SELF) == -1) {
+    close(fl->watch);
+    fl->watch = -1;
+  }
+#endif
+  return fl;
+}
+
+// Stop following and free fl, returns how many bytes of the file were read.
+off_t editor_follow_stop(editor_follow *fl) {
+  if (fl == NULL)
+    return 0;
+  off_t pos = fl->pos;
+  close(fl->fd);
+  if (fl->watch != -1)
+    close(fl->watch);
+  free(fl->filename);
+  free(fl);
+  return pos;
+}
+
+// inotify fd for the loop to poll, -1 when the file has to be looked at on a
+// timer or fl is NULL
+int editor_follow_fd(editor_follow *fl) { return fl != NULL ? fl->watch : -1; }
+
+// the events only tell something changed, editor_follow_read finds out what
+void editor_follow_drain(editor_follow *fl) {
+  char buf[4096];
+  while (fl != NULL && fl->watch != -1 && read(fl->watch, buf, sizeof(buf)) > 0)
+    ;
+}
+
+// Bytes appended since the last read, as text to insert at the end of the
+// last row: a line break ending the text read before starts it, the one
+// ending it is held back. So is a \r ending it, it is read again with what
+// follows, which tells if it is part of a \r\n. Returns the length of the
+// malloc'ed *text, 0 when nothing was appended and -1 when the file shrank or
+// was replaced.
+long editor_follow_read(editor_follow *fl, char **text) {
+  struct stat st;
+  if (stat(fl->filename, &st) == -1 || st.st_dev != fl->dev ||
+      st.st_ino != fl->ino || st.st_size < fl->pos)
+    return -1;
+  if (st.st_size == fl->pos)
+    return 0;
+
+  // up to the size seen, what is written meanwhile comes with the next event
+  off_t start = fl->pos;
+  char *buf = malloc(st.st_size - fl->pos + 1);
+  size_t len = 0;
+  if (fl->ended_line)
+    buf[len++] = '\n';
+  while (fl->pos < st.st_size) {
+    ssize_t nread = pread(fl->fd, buf + len, st.st_size - fl->pos, fl->pos);
+    if (nread == -1 && errno == EINTR)
+      continue;
+    if (nread <= 0)
+      break;
+    len += nread;
+    fl->pos += nread;
+  }
+
+  if (fl->pos == start) {
+    free(buf);
+    return 0;
+  }
+
+  fl->ended_line = buf[len - 1] == '\n';
+  if (fl->ended_line) {
+    len--;
+  } else {
+    // the line break read before, if any, stops it
+    while (len > 0 && buf[len - 1] == '\r') {
+      len--;
+      fl->pos--;
+    }
+  }
+  // a line loses the \r ending it, as when the file is loaded
+  while (len > 0 && buf[len - 1] == '\r')
+    len--;
+  // a line break ending the row it goes to
+  if (len == 0) {
+    free(buf);
+    return 0;
+  }
+  *text = buf;
+  return len;
+}
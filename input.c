@@ -0,0 +1,113 @@
+#include "editor.h"
+
+// Terminal input, read through a ring buffer.
+// Every read takes all the bytes the terminal has ready, keys are then
+// decoded from the buffer without a syscall each. A paste or a burst of
+// autorepeat arrives in a few reads, and the main loop handles every key it
+// holds before drawing the next frame.
+
+#define INPUT_BUFFER_SIZE 4096
+// how long the rest of an escape sequence may take to come in
+#define INPUT_SEQUENCE_TIMEOUT_MS 100
+// a pause this long ends a paste whose end was lost
+#define INPUT_PASTE_TIMEOUT_MS 1000
+
+static struct {
+  unsigned char buf[INPUT_BUFFER_SIZE];
+  // bytes are read at head and taken from tail, both grow forever
+  unsigned int head, tail;
+} in;
+
+// read what the terminal has ready, waiting up to timeout ms for something,
+// forever when timeout is -1. Returns the number of bytes read.
+static int input_fill(int timeout) {
+  unsigned int space = INPUT_BUFFER_SIZE - (in.head - in.tail);
+  if (space == 0)
+    return 0;
+
+  struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+  int ready;
+  while ((ready = poll(&fd, 1, timeout)) == -1) {
+    if (errno != EINTR)
+      die("poll");
+  }
+  if (ready == 0)
+    return 0;
+
+  // up to the end of the ring, what wraps around comes with the next fill
+  unsigned int at = in.head % INPUT_BUFFER_SIZE;
+  unsigned int len = IMIN(space, INPUT_BUFFER_SIZE - at);
+  ssize_t n = read(STDIN_FILENO, &in.buf[at], len);
+  if (n == -1) {
+    /*
+     * In Cygwin, when read() times out it returns -1 with an errno of EAGAIN,
+     * instead of just returning 0 like it’s supposed to. To make it work in
+     * Cygwin, we won’t treat EAGAIN as an error.
+     * */
+    if (errno != EAGAIN && errno != EINTR)
+      die("read");
+    return 0;
+  }
+  // readable but nothing to read, the terminal is gone
+  if (n == 0)
+    die("read");
+  in.head += n;
+  return n;
+}
+
+// Next input byte in *c. Waits up to timeout ms for it, forever when timeout
+// is -1. Returns 0 when none came in.
+int editor_input_byte(char *c, int timeout) {
+  while (in.head == in.tail) {
+    if (input_fill(timeout) == 0 && timeout != -1)
+      return 0;
+  }
+  *c = in.buf[in.tail++ % INPUT_BUFFER_SIZE];
+  return 1;
+}
+
+// byte of an escape sequence already started, a lone ESC gets none
+int editor_input_sequence_byte(char *c) {
+  return editor_input_byte(c, INPUT_SEQUENCE_TIMEOUT_MS);
+}
+
+// 1 if a key is waiting to be read, without blocking
+int editor_input_pending() {
+  return in.head != in.tail || input_fill(0) > 0;
+}
+
+// Text of a bracketed paste, up to the ESC [201~ ending it. It is moved out
+// of the ring a buffer at a time rather than decoded as keys. Returns a
+// malloc'ed buffer of *len bytes.
+char *editor_input_paste(size_t *len) {
+  static const char end[] = "\x1b[201~";
+  size_t end_len = sizeof(end) - 1;
+  size_t cap = INPUT_BUFFER_SIZE, n = 0;
+  char *text = malloc(cap);
+
+  while (in.head != in.tail || input_fill(INPUT_PASTE_TIMEOUT_MS) > 0) {
+    unsigned int at = in.tail % INPUT_BUFFER_SIZE;
+    unsigned int avail = IMIN(in.head - in.tail, INPUT_BUFFER_SIZE - at);
+    if (n + avail > cap) {
+      while (n + avail > cap)
+        cap *= 2;
+      text = realloc(text, cap);
+    }
+    memcpy(text + n, &in.buf[at], avail);
+    in.tail += avail;
+
+    // the end may straddle two reads
+    size_t from = n >= end_len ? n - end_len + 1 : 0;
+    n += avail;
+    char *found = memmem(text + from, n - from, end, end_len);
+    if (found != NULL) {
+      // the keys typed after the paste stay in the ring
+      size_t stop = found - text;
+      in.tail -= n - stop - end_len;
+      n = stop;
+      break;
+    }
+  }
+  *len = n;
+  return text;
+}
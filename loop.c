@@ -0,0 +1,194 @@
+#include "editor.h"
+#include <limits.h>
+#include <signal.h>
+
+// Event loop the editor waits for keys in.
+// Until a key comes in it wakes up for a resize of the terminal, for the
+// timers that came due, for the matches of a running search, for the lines
+// counted in paging mode and for a followed file growing, and runs the queued
+// idle tasks one step at a time in between. With none of those left it sleeps
+// in poll, nothing is polled or redrawn on a timer.
+
+#define LOOP_MAX_TIMERS 8
+#define LOOP_MAX_IDLE 8
+
+typedef struct {
+  // CLOCK_MONOTONIC ms it is due at
+  long long due;
+  void (*fired)();
+} loop_timer;
+
+static struct {
+  // SIGWINCH writes to wake[1], the loop polls wake[0]
+  int wake[2];
+  loop_timer timers[LOOP_MAX_TIMERS];
+  int ntimers;
+  // tasks with work left, run in turn
+  int (*idle[LOOP_MAX_IDLE])();
+  int nidle;
+  // an idle step changed what is shown
+  int redraw;
+} loop = {.wake = {-1, -1}};
+
+static long long loop_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void loop_on_resize(int sig) {
+  (void)sig;
+  int saved = errno;
+  // fails only when the pipe is full, it already holds a wake up then
+  write(loop.wake[1], "w", 1);
+  errno = saved;
+}
+
+void editor_loop_init() {
+  if (pipe(loop.wake) == -1)
+    die("pipe");
+  for (int i = 0; i < 2; i++) {
+    fcntl(loop.wake[i], F_SETFL, O_NONBLOCK);
+    fcntl(loop.wake[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = loop_on_resize;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGWINCH, &sa, NULL) == -1)
+    die("sigaction");
+}
+
+// Call fired once in ms milliseconds. A timer set again with the same
+// callback is moved rather than added.
+void editor_loop_timer(int ms, void (*fired)()) {
+  int i = 0;
+  while (i < loop.ntimers && loop.timers[i].fired != fired)
+    i++;
+  if (i == loop.ntimers) {
+    if (loop.ntimers == LOOP_MAX_TIMERS)
+      die("editor_loop_timer");
+    loop.ntimers++;
+  }
+  loop.timers[i].due = loop_now() + ms;
+  loop.timers[i].fired = fired;
+}
+
+// Queue task to run while no key is waiting. It does a slice of its work per
+// call and returns 1 as long as some is left, it is dropped once it returns 0.
+// A task already queued is not queued twice.
+void editor_loop_idle(int (*task)()) {
+  for (int i = 0; i < loop.nidle; i++) {
+    if (loop.idle[i] == task)
+      return;
+  }
+  if (loop.nidle == LOOP_MAX_IDLE)
+    die("editor_loop_idle");
+  loop.idle[loop.nidle++] = task;
+}
+
+// called by an idle task that changed what is shown, the screen is drawn
+// again after its step
+void editor_loop_redraw() { loop.redraw = 1; }
+
+// one step of the first task, which then goes to the back of the queue
+static void loop_run_idle() {
+  int (*task)() = loop.idle[0];
+  loop.nidle--;
+  memmove(&loop.idle[0], &loop.idle[1], sizeof(loop.idle[0]) * loop.nidle);
+  if (task())
+    editor_loop_idle(task);
+}
+
+// run the timers that came due, returns 1 if any did
+static int loop_fire_timers() {
+  long long now = loop_now();
+  int fired = 0;
+  for (int i = 0; i < loop.ntimers;) {
+    if (loop.timers[i].due > now) {
+      i++;
+      continue;
+    }
+    // removed first, the callback may set it again
+    void (*callback)() = loop.timers[i].fired;
+    loop.timers[i] = loop.timers[--loop.ntimers];
+    callback();
+    fired = 1;
+  }
+  return fired;
+}
+
+// ms poll may sleep for, 0 with idle work to do and -1 with no timer set
+static int loop_timeout() {
+  if (loop.nidle > 0)
+    return 0;
+  if (loop.ntimers == 0)
+    return -1;
+  long long due = loop.timers[0].due;
+  for (int i = 1; i < loop.ntimers; i++) {
+    if (loop.timers[i].due < due)
+      due = loop.timers[i].due;
+  }
+  long long wait = due - loop_now();
+  return wait < 0 ? 0 : wait > INT_MAX ? INT_MAX : (int)wait;
+}
+
+// Wait for the next key, returns 0 once one is ready. Returns REDRAW first
+// when the terminal was resized, a timer fired, an idle task changed what is
+// shown, the pager counted more lines or the followed file grew, and
+// SEARCH_PROGRESS when the search index found more matches.
+int editor_loop_wait() {
+  while (!editor_input_pending()) {
+    if (loop_fire_timers())
+      return REDRAW;
+
+    // poll skips the search, pager and follow fds while they are -1, only
+    // the ones of the buffer shown are looked at
+    editor_buffer *b = editor_current_buffer();
+    struct pollfd fds[5] = {{STDIN_FILENO, POLLIN, 0},
+                            {loop.wake[0], POLLIN, 0},
+                            {editor_match_index_fd(), POLLIN, 0},
+                            {editor_pager_fd(b->pager), POLLIN, 0},
+                            {editor_follow_fd(b->follow), POLLIN, 0}};
+    int ready = poll(fds, 5, loop_timeout());
+    if (ready == -1) {
+      if (errno != EINTR)
+        die("poll");
+      continue;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char buf[64];
+      while (read(loop.wake[0], buf, sizeof(buf)) > 0)
+        ;
+      editor_refresh_window_size();
+      return REDRAW;
+    }
+    // keys go first, the loop reads them on its next turn
+    if (fds[0].revents)
+      continue;
+    if (fds[2].revents & POLLIN) {
+      editor_match_index_drain();
+      return SEARCH_PROGRESS;
+    }
+    if (fds[3].revents & POLLIN) {
+      editor_pager_drain(b->pager);
+      return REDRAW;
+    }
+    if (fds[4].revents & POLLIN) {
+      editor_follow_drain(b->follow);
+      editor_follow_update();
+      return REDRAW;
+    }
+    if (ready == 0 && loop.nidle > 0) {
+      loop_run_idle();
+      if (loop.redraw) {
+        loop.redraw = 0;
+        return REDRAW;
+      }
+    }
+  }
+  return 0;
+}
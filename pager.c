@@ -0,0 +1,333 @@
+#include "editor.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Read only paging mode for files too big to load.
+// The file is mapped and its lines are drawn straight from the mapping, no
+// row is built for them. The view moves by byte offsets so it never waits
+// for the line index: a worker thread counts the lines in the background and
+// keeps the offset of every step-th line start. Past PAGER_MAX_MARKS marks
+// the step doubles and every other mark goes, so the index stays the same
+// size however big the file is. The pages the worker and the search went
+// through are given back as they go, only the ones drawn stay resident.
+
+// lines between two marks to begin with
+#define PAGER_STEP 1024
+#define PAGER_MAX_MARKS (1 << 20)
+// bytes scanned between two looks at a cancel and two updates of progress
+#define PAGER_SCAN_BYTES (16 << 20)
+#define PAGER_WAKE_INTERVAL 0.1
+
+struct editor_pager {
+  pthread_mutex_t lock;
+  pthread_cond_t progress;
+  pthread_t thread;
+  int running;
+  int cancel;
+  int wake[2];
+
+  // the whole file, read only
+  const char *map;
+  size_t size;
+
+  // marks[i] is the offset of line i * step, shared under lock
+  size_t *marks;
+  long nmarks;
+  long cap;
+  long step;
+  // newlines counted in the bytes before scanned
+  long lines;
+  size_t scanned;
+  int done;
+  // when the worker last woke the loop up
+  double woke;
+};
+
+static double pager_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// wake the loop up to show the progress, at most every PAGER_WAKE_INTERVAL
+static void pager_wake(editor_pager *p, int now) {
+  double t = pager_now();
+  if (!now && t - p->woke < PAGER_WAKE_INTERVAL)
+    return;
+  p->woke = t;
+  // full pipe means the loop has a wake up pending already
+  if (write(p->wake[1], "", 1) == -1) {
+  }
+}
+
+// drop the pages in [from, to) from memory, they are read back from the file
+// when needed again
+static void pager_release(editor_pager *p, size_t from, size_t to) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  from = (from + page - 1) / page * page;
+  to = to / page * page;
+  if (from < to)
+    madvise((char *)p->map + from, to - from, MADV_DONTNEED);
+}
+
+// Offset in buf just past its *k-th newline, *k is then 0. With fewer
+// newlines in buf returns len and *k is what is left to find.
+static size_t pager_skip_lines(const char *buf, size_t len, long *k) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+    int n = __builtin_popcount(mask);
+    if (n >= *k) {
+      // drop the newlines before the k-th one
+      for (long j = 1; j < *k; j++)
+        mask &= mask - 1;
+      *k = 0;
+      return i + __builtin_ctz(mask) + 1;
+    }
+    *k -= n;
+  }
+#endif
+  for (; i < len; i++) {
+    if (buf[i] == '\n' && --*k == 0)
+      return i + 1;
+  }
+  return len;
+}
+
+// add the mark of line nmarks * step, which starts at at
+static void pager_add_mark(editor_pager *p, size_t at) {
+  pthread_mutex_lock(&p->lock);
+  if (p->nmarks == PAGER_MAX_MARKS) {
+    // every other mark goes, the step doubles
+    for (long i = 0; i < p->nmarks / 2; i++)
+      p->marks[i] = p->marks[2 * i];
+    p->nmarks /= 2;
+    p->step *= 2;
+  }
+  if (p->nmarks == p->cap) {
+    p->cap *= 2;
+    p->marks = realloc(p->marks, sizeof(size_t) * p->cap);
+  }
+  p->marks[p->nmarks++] = at;
+  pthread_mutex_unlock(&p->lock);
+}
+
+static void *pager_worker(void *arg) {
+  editor_pager *p = arg;
+  size_t at = 0;
+  long lines = 0;
+  while (at < p->size) {
+    size_t start = at;
+    size_t end =
+        p->size - at > PAGER_SCAN_BYTES ? at + PAGER_SCAN_BYTES : p->size;
+    while (at < end) {
+      // only the worker changes step and nmarks, it reads them unlocked
+      long want = p->nmarks * p->step - lines;
+      long k = want;
+      at += pager_skip_lines(p->map + at, end - at, &k);
+      lines += want - k;
+      if (k == 0 && at < p->size)
+        pager_add_mark(p, at);
+    }
+    pager_release(p, start, end);
+
+    pthread_mutex_lock(&p->lock);
+    p->lines = lines;
+    p->scanned = at;
+    int cancel = p->cancel;
+    pthread_cond_broadcast(&p->progress);
+    pthread_mutex_unlock(&p->lock);
+    if (cancel)
+      return NULL;
+    pager_wake(p, 0);
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->done = 1;
+  pthread_cond_broadcast(&p->progress);
+  pthread_mutex_unlock(&p->lock);
+  pager_wake(p, 1);
+  return NULL;
+}
+
+// Map size bytes of fd and start indexing its lines. Returns NULL when it
+// cannot be mapped, fd can be closed either way.
+editor_pager *editor_pager_open(int fd, size_t size) {
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  madvise(map, size, MADV_SEQUENTIAL);
+  editor_pager *p = calloc(1, sizeof(editor_pager));
+  if (pipe(p->wake) == -1)
+    die("pipe");
+  fcntl(p->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(p->wake[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->progress, NULL);
+
+  p->map = map;
+  p->size = size;
+  p->cap = 1024;
+  p->marks = malloc(sizeof(size_t) * p->cap);
+  p->marks[0] = 0;
+  p->nmarks = 1;
+  p->step = PAGER_STEP;
+  p->running = pthread_create(&p->thread, NULL, pager_worker, p) == 0;
+  if (!p->running)
+    pager_worker(p);
+  return p;
+}
+
+void editor_pager_close(editor_pager *p) {
+  if (p == NULL)
+    return;
+  if (p->running) {
+    pthread_mutex_lock(&p->lock);
+    p->cancel = 1;
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+  }
+  munmap((void *)p->map, p->size);
+  close(p->wake[0]);
+  close(p->wake[1]);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->progress);
+  free(p->marks);
+  free(p);
+}
+
+// the mapping, *size bytes long
+const char *editor_pager_text(editor_pager *p, size_t *size) {
+  *size = p->size;
+  return p->map;
+}
+
+// read end of the pipe the worker wakes the loop up with, -1 without pager
+int editor_pager_fd(editor_pager *p) { return p != NULL ? p->wake[0] : -1; }
+
+void editor_pager_drain(editor_pager *p) {
+  char buf[64];
+  while (p != NULL && read(p->wake[0], buf, sizeof(buf)) > 0)
+    ;
+}
+
+// Lines counted so far, *done once the count is final.
+long editor_pager_lines(editor_pager *p, int *done) {
+  pthread_mutex_lock(&p->lock);
+  long lines = p->lines;
+  *done = p->done;
+  pthread_mutex_unlock(&p->lock);
+  // the last line may lack a newline
+  if (*done && p->size > 0 && p->map[p->size - 1] != '\n')
+    lines++;
+  return lines;
+}
+
+// Offset of the start of line, waiting for the worker to get there. Returns
+// 0 when the file has fewer lines.
+int editor_pager_line_offset(editor_pager *p, long line, size_t *offset) {
+  pthread_mutex_lock(&p->lock);
+  while (p->lines < line && !p->done && p->running)
+    pthread_cond_wait(&p->progress, &p->lock);
+  long mark = line / p->step;
+  long k = line % p->step;
+  int known = mark < p->nmarks;
+  size_t at = known ? p->marks[mark] : 0;
+  pthread_mutex_unlock(&p->lock);
+  if (!known)
+    return 0;
+
+  if (k > 0)
+    at += pager_skip_lines(p->map + at, p->size - at, &k);
+  if (k > 0 || at >= p->size)
+    return 0;
+  *offset = at;
+  return 1;
+}
+
+// Number of the line holding offset, -1 while the worker has not got there.
+long editor_pager_line_number(editor_pager *p, size_t offset) {
+  pthread_mutex_lock(&p->lock);
+  if (offset >= p->scanned && !p->done) {
+    pthread_mutex_unlock(&p->lock);
+    return -1;
+  }
+  // last mark at or before offset
+  long lo = 0, hi = p->nmarks;
+  while (hi - lo > 1) {
+    long mid = lo + (hi - lo) / 2;
+    if (p->marks[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  long line = lo * p->step;
+  size_t at = p->marks[lo];
+  pthread_mutex_unlock(&p->lock);
+  return line + editor_count_lines(p->map + at, offset - at);
+}
+
+// offset of the line after the one starting at at, the file size after the
+// last one
+size_t editor_pager_next_line(editor_pager *p, size_t at) {
+  const char *eol = memchr(p->map + at, '\n', p->size - at);
+  return eol != NULL ? (size_t)(eol - p->map + 1) : p->size;
+}
+
+// offset of the start of the line holding at
+size_t editor_pager_line_start(editor_pager *p, size_t at) {
+  while (at > 0 && p->map[at - 1] != '\n')
+    at--;
+  return at;
+}
+
+// Offset of the first match of s at or after from, -1 if none.
+long editor_pager_search_forward(editor_pager *p, editor_search *s,
+                                 size_t from) {
+  if (s->len == 0)
+    return -1;
+  // windows overlap by the needle, a match may straddle two
+  while (from + s->len <= p->size) {
+    size_t window = PAGER_SCAN_BYTES + s->len - 1;
+    size_t end = p->size - from > window ? from + window : p->size;
+    long found = editor_search_buf(s, p->map + from, end - from);
+    pager_release(p, from, end);
+    if (found != -1)
+      return from + found;
+    from = end - s->len + 1;
+  }
+  return -1;
+}
+
+// Offset of the last match of s starting before from, -1 if none.
+long editor_pager_search_backward(editor_pager *p, editor_search *s,
+                                  size_t from) {
+  if (s->len == 0)
+    return -1;
+  while (from > 0) {
+    size_t start = from > PAGER_SCAN_BYTES ? from - PAGER_SCAN_BYTES : 0;
+    size_t end = from + s->len - 1 < p->size ? from + s->len - 1 : p->size;
+    long last = -1;
+    size_t at = start;
+    long found;
+    while (at < from &&
+           (found = editor_search_buf(s, p->map + at, end - at)) != -1 &&
+           at + found < from) {
+      last = at + found;
+      at = last + 1;
+    }
+    pager_release(p, start, end);
+    if (last != -1)
+      return last;
+    from = start;
+  }
+  return -1;
+}
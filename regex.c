@@ -0,0 +1,815 @@
+#include "editor.h"
+
+// Regular expressions for the search prompt.
+// A pattern is parsed into a tree, then built into two Thompson NFAs, one
+// reading the pattern forward and one reading it reversed. Both run as lazy
+// DFAs: a DFA state is a set of NFA states, made the first time a byte leads
+// to it and cached with its transitions, so a byte costs one table lookup
+// and nothing ever backtracks. When the cache is full it is emptied and
+// filled again from the current state.
+//
+// Matches are leftmost-longest, never empty, and never span rows. The
+// reversed pattern, behind a loop on any byte, runs from the end of a row back
+// to its start and marks every offset a match starts at. The forward pattern
+// then runs from the first of them for the longest match, and so on from
+// past its end.
+//
+// Supported: literals, ., [...] and [^...] with ranges, \d \w \s \D \W \S,
+// \ to escape, ^ $, * + ? {m} {m,} {m,n}, | and (...).
+
+#define REGEX_MAX_NFA_STATES 16384
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_DFA_STATES 2048
+
+enum regex_node_type {
+  REGEX_CLASS,
+  REGEX_BOL,
+  REGEX_EOL,
+  REGEX_EMPTY,
+  REGEX_CAT,
+  REGEX_ALT,
+  REGEX_REPEAT
+};
+
+typedef struct {
+  int type;
+  // REGEX_CLASS: index in sets
+  int set;
+  // children, indexes in nodes
+  int a, b;
+  // REGEX_REPEAT: max -1 for no bound
+  int min, max;
+} regex_node;
+
+enum regex_nfa_type { NFA_BYTE, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+typedef struct {
+  unsigned char type;
+  int set;
+  int out, out1;
+} regex_nfa_state;
+
+// accept flags of a dfa state
+#define DFA_MATCH 1
+// matches once the assertion at the end of the scan holds ($ forward, ^ back)
+#define DFA_MATCH_EDGE 2
+#define DFA_DEAD 4
+
+typedef struct {
+  unsigned char (*sets)[32];
+  regex_nfa_state *nfa;
+  int nfa_count;
+  int nfa_start;
+  // the start states are kept in every state, the pattern may start anywhere
+  int unanchored;
+  // assertion holding where the scan begins and where it ends
+  int begin, edge;
+
+  int *trans;
+  unsigned char *accept;
+  int *set_at, *set_len;
+  int *pool;
+  int pool_len, pool_cap;
+  int count, cap;
+  int *hash;
+  // dfa state of the start, plain or after begin
+  int start[2];
+
+  // closure scratch
+  int *list, *stack;
+  unsigned int *mark;
+  unsigned int gen;
+} regex_dfa;
+
+struct editor_regex {
+  int ignore_case;
+  unsigned char (*sets)[32];
+  int set_count;
+  regex_node *nodes;
+  int node_count;
+  regex_dfa forward, reverse;
+  // longest run of bytes every match holds
+  char *literal;
+
+  // offsets where a match starts in row, ascending
+  editor_row *row;
+  int *starts;
+  int start_count, start_cap;
+};
+
+typedef struct {
+  editor_regex *re;
+  const char *p;
+  const char *error;
+} regex_parser;
+
+static int regex_set_has(unsigned char *set, int c) {
+  return set[c >> 3] & (1 << (c & 7));
+}
+
+static void regex_set_add(unsigned char *set, int c) {
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+static int regex_new_set(editor_regex *re) {
+  re->sets = realloc(re->sets, sizeof(re->sets[0]) * (re->set_count + 1));
+  memset(re->sets[re->set_count], 0, sizeof(re->sets[0]));
+  return re->set_count++;
+}
+
+static int regex_new_node(editor_regex *re, int type, int a, int b) {
+  re->nodes = realloc(re->nodes, sizeof(regex_node) * (re->node_count + 1));
+  regex_node *n = &re->nodes[re->node_count];
+  n->type = type;
+  n->set = -1;
+  n->a = a;
+  n->b = b;
+  n->min = 0;
+  n->max = 0;
+  return re->node_count++;
+}
+
+static int regex_class_node(editor_regex *re, int set) {
+  int n = regex_new_node(re, REGEX_CLASS, -1, -1);
+  re->nodes[n].set = set;
+  return n;
+}
+
+// add the bytes \d \w \s and their negations stand for
+static int regex_add_escape_class(unsigned char *set, char e) {
+  int lower = tolower(e);
+  if (lower != 'd' && lower != 'w' && lower != 's')
+    return 0;
+  for (int c = 0; c < 256; c++) {
+    int in = lower == 'd'   ? isdigit(c)
+             : lower == 'w' ? isalnum(c) || c == '_'
+                            : isspace(c);
+    if ((in != 0) != (e != lower))
+      regex_set_add(set, c);
+  }
+  return 1;
+}
+
+static int regex_escaped_byte(char e) {
+  switch (e) {
+  case 't':
+    return '\t';
+  case 'n':
+    return '\n';
+  case 'r':
+    return '\r';
+  default:
+    return (unsigned char)e;
+  }
+}
+
+// with case ignored a letter matches both cases, a negated class must be
+// folded before it is negated
+static void regex_fold_set(editor_regex *re, int set) {
+  if (!re->ignore_case)
+    return;
+  for (int c = 'a'; c <= 'z'; c++) {
+    if (regex_set_has(re->sets[set], c) ||
+        regex_set_has(re->sets[set], toupper(c))) {
+      regex_set_add(re->sets[set], c);
+      regex_set_add(re->sets[set], toupper(c));
+    }
+  }
+}
+
+static int regex_parse_alt(regex_parser *ps);
+
+static int regex_parse_class(regex_parser *ps) {
+  editor_regex *re = ps->re;
+  int set = regex_new_set(re);
+  int negate = *ps->p == '^';
+  if (negate)
+    ps->p++;
+  int first = 1;
+  while (*ps->p && (*ps->p != ']' || first)) {
+    first = 0;
+    int lo;
+    if (*ps->p == '\\' && ps->p[1]) {
+      if (regex_add_escape_class(re->sets[set], ps->p[1])) {
+        ps->p += 2;
+        continue;
+      }
+      lo = regex_escaped_byte(ps->p[1]);
+      ps->p += 2;
+    } else {
+      lo = (unsigned char)*ps->p++;
+    }
+    int hi = lo;
+    if (*ps->p == '-' && ps->p[1] && ps->p[1] != ']') {
+      ps->p++;
+      if (*ps->p == '\\' && ps->p[1]) {
+        hi = regex_escaped_byte(ps->p[1]);
+        ps->p += 2;
+      } else {
+        hi = (unsigned char)*ps->p++;
+      }
+      if (hi < lo) {
+        ps->error = "bad range";
+        return -1;
+      }
+    }
+    for (int c = lo; c <= hi; c++)
+      regex_set_add(re->sets[set], c);
+  }
+  if (*ps->p != ']') {
+    ps->error = "missing ]";
+    return -1;
+  }
+  ps->p++;
+  regex_fold_set(re, set);
+  if (negate) {
+    for (int i = 0; i < 32; i++)
+      re->sets[set][i] = ~re->sets[set][i];
+  }
+  return regex_class_node(re, set);
+}
+
+static int regex_parse_atom(regex_parser *ps) {
+  editor_regex *re = ps->re;
+  char c = *ps->p++;
+  switch (c) {
+  case '(': {
+    int n = regex_parse_alt(ps);
+    if (n == -1)
+      return -1;
+    if (*ps->p != ')') {
+      ps->error = "missing )";
+      return -1;
+    }
+    ps->p++;
+    return n;
+  }
+  case '[':
+    return regex_parse_class(ps);
+  case '^':
+    return regex_new_node(re, REGEX_BOL, -1, -1);
+  case '$':
+    return regex_new_node(re, REGEX_EOL, -1, -1);
+  case '.': {
+    int set = regex_new_set(re);
+    memset(re->sets[set], 0xff, sizeof(re->sets[0]));
+    return regex_class_node(re, set);
+  }
+  case '*':
+  case '+':
+  case '?':
+  case '{':
+    ps->error = "nothing to repeat";
+    return -1;
+  case '\\': {
+    if (*ps->p == '\0') {
+      ps->error = "trailing \\";
+      return -1;
+    }
+    int set = regex_new_set(re);
+    if (!regex_add_escape_class(re->sets[set], *ps->p)) {
+      regex_set_add(re->sets[set], regex_escaped_byte(*ps->p));
+      regex_fold_set(re, set);
+    }
+    ps->p++;
+    return regex_class_node(re, set);
+  }
+  default: {
+    int set = regex_new_set(re);
+    regex_set_add(re->sets[set], (unsigned char)c);
+    regex_fold_set(re, set);
+    return regex_class_node(re, set);
+  }
+  }
+}
+
+static int regex_parse_number(regex_parser *ps) {
+  if (!isdigit((unsigned char)*ps->p))
+    return -1;
+  int n = 0;
+  while (isdigit((unsigned char)*ps->p)) {
+    n = n * 10 + (*ps->p++ - '0');
+    if (n > REGEX_MAX_REPEAT)
+      n = REGEX_MAX_REPEAT + 1;
+  }
+  return n;
+}
+
+static int regex_parse_repeat(regex_parser *ps) {
+  int n = regex_parse_atom(ps);
+  while (n != -1) {
+    int min, max;
+    if (*ps->p == '*') {
+      min = 0;
+      max = -1;
+    } else if (*ps->p == '+') {
+      min = 1;
+      max = -1;
+    } else if (*ps->p == '?') {
+      min = 0;
+      max = 1;
+    } else if (*ps->p == '{') {
+      ps->p++;
+      min = regex_parse_number(ps);
+      max = min;
+      if (*ps->p == ',') {
+        ps->p++;
+        max = *ps->p == '}' ? -1 : regex_parse_number(ps);
+      }
+      if (min == -1 || *ps->p != '}' || (max != -1 && max < min)) {
+        ps->error = "bad repeat";
+        return -1;
+      }
+      if (min > REGEX_MAX_REPEAT || max > REGEX_MAX_REPEAT) {
+        ps->error = "repeat too big";
+        return -1;
+      }
+    } else {
+      return n;
+    }
+    ps->p++;
+    int r = regex_new_node(ps->re, REGEX_REPEAT, n, -1);
+    ps->re->nodes[r].min = min;
+    ps->re->nodes[r].max = max;
+    n = r;
+  }
+  return -1;
+}
+
+static int regex_parse_cat(regex_parser *ps) {
+  int n = -1;
+  while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+    int next = regex_parse_repeat(ps);
+    if (next == -1)
+      return -1;
+    n = n == -1 ? next : regex_new_node(ps->re, REGEX_CAT, n, next);
+  }
+  return n == -1 ? regex_new_node(ps->re, REGEX_EMPTY, -1, -1) : n;
+}
+
+static int regex_parse_alt(regex_parser *ps) {
+  int n = regex_parse_cat(ps);
+  while (n != -1 && *ps->p == '|') {
+    ps->p++;
+    int next = regex_parse_cat(ps);
+    if (next == -1)
+      return -1;
+    n = regex_new_node(ps->re, REGEX_ALT, n, next);
+  }
+  return n;
+}
+
+static int regex_nfa_add(regex_dfa *d, int type, int set, int out, int out1) {
+  if (d->nfa_count == REGEX_MAX_NFA_STATES)
+    return -1;
+  d->nfa = realloc(d->nfa, sizeof(regex_nfa_state) * (d->nfa_count + 1));
+  regex_nfa_state *s = &d->nfa[d->nfa_count];
+  s->type = type;
+  s->set = set;
+  s->out = out;
+  s->out1 = out1;
+  return d->nfa_count++;
+}
+
+// Build the states of node in front of next, returns its first state or -1
+// when the pattern is too big. reverse builds the reversed pattern.
+static int regex_nfa_build(editor_regex *re, regex_dfa *d, int node, int next,
+                           int reverse) {
+  if (next == -1)
+    return -1;
+  regex_node *n = &re->nodes[node];
+  switch (n->type) {
+  case REGEX_CLASS:
+    return regex_nfa_add(d, NFA_BYTE, n->set, next, -1);
+  case REGEX_BOL:
+    return regex_nfa_add(d, NFA_BOL, -1, next, -1);
+  case REGEX_EOL:
+    return regex_nfa_add(d, NFA_EOL, -1, next, -1);
+  case REGEX_EMPTY:
+    return next;
+  case REGEX_CAT: {
+    int a = n->a, b = n->b;
+    if (reverse) {
+      a = n->b;
+      b = n->a;
+    }
+    return regex_nfa_build(re, d, a, regex_nfa_build(re, d, b, next, reverse),
+                           reverse);
+  }
+  case REGEX_ALT: {
+    int a = regex_nfa_build(re, d, n->a, next, reverse);
+    int b = regex_nfa_build(re, d, n->b, next, reverse);
+    if (a == -1 || b == -1)
+      return -1;
+    return regex_nfa_add(d, NFA_SPLIT, -1, a, b);
+  }
+  case REGEX_REPEAT: {
+    int min = n->min, max = n->max, child = n->a;
+    int tail = next;
+    if (max == -1) {
+      // loop back through a split
+      int split = regex_nfa_add(d, NFA_SPLIT, -1, -1, next);
+      if (split == -1)
+        return -1;
+      int body = regex_nfa_build(re, d, child, split, reverse);
+      if (body == -1)
+        return -1;
+      d->nfa[split].out = body;
+      tail = split;
+    } else {
+      // each optional copy may leave for next
+      for (int i = min; i < max && tail != -1; i++) {
+        int body = regex_nfa_build(re, d, child, tail, reverse);
+        if (body == -1)
+          return -1;
+        tail = regex_nfa_add(d, NFA_SPLIT, -1, body, next);
+      }
+    }
+    for (int i = 0; i < min && tail != -1; i++)
+      tail = regex_nfa_build(re, d, child, tail, reverse);
+    return tail;
+  }
+  }
+  return -1;
+}
+
+static int regex_dfa_init(editor_regex *re, regex_dfa *d, int root,
+                          int reverse) {
+  memset(d, 0, sizeof(regex_dfa));
+  d->sets = re->sets;
+  int match = regex_nfa_add(d, NFA_MATCH, -1, -1, -1);
+  d->nfa_start = regex_nfa_build(re, d, root, match, reverse);
+  if (d->nfa_start == -1)
+    return -1;
+  d->unanchored = reverse;
+  d->begin = reverse ? NFA_EOL : NFA_BOL;
+  d->edge = reverse ? NFA_BOL : NFA_EOL;
+  d->list = malloc(sizeof(int) * d->nfa_count);
+  // a state is pushed once for each state leading to it
+  d->stack = malloc(sizeof(int) * (d->nfa_count * 2 + 1));
+  d->mark = calloc(d->nfa_count, sizeof(unsigned int));
+  d->hash = malloc(sizeof(int) * REGEX_DFA_STATES * 2);
+  d->count = 0;
+  memset(d->hash, -1, sizeof(int) * REGEX_DFA_STATES * 2);
+  d->start[0] = d->start[1] = -1;
+  return 0;
+}
+
+static void regex_dfa_free(regex_dfa *d) {
+  free(d->nfa);
+  free(d->trans);
+  free(d->accept);
+  free(d->set_at);
+  free(d->set_len);
+  free(d->pool);
+  free(d->hash);
+  free(d->list);
+  free(d->stack);
+  free(d->mark);
+}
+
+// forget every dfa state
+static void regex_dfa_flush(regex_dfa *d) {
+  d->count = 0;
+  d->pool_len = 0;
+  memset(d->hash, -1, sizeof(int) * REGEX_DFA_STATES * 2);
+  d->start[0] = d->start[1] = -1;
+}
+
+// add state s and the states it reaches without reading to list[*n], only
+// the states that read or match are kept
+static void regex_closure(regex_dfa *d, int *list, int *n, int s) {
+  int top = 0;
+  d->stack[top++] = s;
+  while (top > 0) {
+    s = d->stack[--top];
+    if (d->mark[s] == d->gen)
+      continue;
+    d->mark[s] = d->gen;
+    regex_nfa_state *st = &d->nfa[s];
+    if (st->type == NFA_SPLIT) {
+      d->stack[top++] = st->out1;
+      d->stack[top++] = st->out;
+    } else {
+      list[(*n)++] = s;
+    }
+  }
+}
+
+// follow the assertion states of type in list[0, *n)
+static void regex_closure_assert(regex_dfa *d, int *list, int *n, int type) {
+  for (int i = 0; i < *n; i++) {
+    if (d->nfa[list[i]].type == type)
+      regex_closure(d, list, n, d->nfa[list[i]].out);
+  }
+}
+
+static int regex_list_has_match(regex_dfa *d, int *list, int n) {
+  for (int i = 0; i < n; i++) {
+    if (d->nfa[list[i]].type == NFA_MATCH)
+      return 1;
+  }
+  return 0;
+}
+
+static int regex_compare_int(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+static unsigned int regex_hash_list(int *list, int n) {
+  unsigned int h = 2166136261u;
+  for (int i = 0; i < n; i++) {
+    h ^= (unsigned int)list[i];
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+// dfa state for the nfa states in d->list[0, n), -1 if the cache is full
+static int regex_dfa_intern(regex_dfa *d, int n) {
+  qsort(d->list, n, sizeof(int), regex_compare_int);
+  unsigned int mask = REGEX_DFA_STATES * 2 - 1;
+  unsigned int h = regex_hash_list(d->list, n) & mask;
+  while (d->hash[h] != -1) {
+    int s = d->hash[h];
+    if (d->set_len[s] == n &&
+        !memcmp(&d->pool[d->set_at[s]], d->list, sizeof(int) * n))
+      return s;
+    h = (h + 1) & mask;
+  }
+  if (d->count == REGEX_DFA_STATES)
+    return -1;
+
+  if (d->count == d->cap) {
+    d->cap = d->cap ? d->cap * 2 : 64;
+    d->trans = realloc(d->trans, sizeof(int) * 256 * d->cap);
+    d->accept = realloc(d->accept, d->cap);
+    d->set_at = realloc(d->set_at, sizeof(int) * d->cap);
+    d->set_len = realloc(d->set_len, sizeof(int) * d->cap);
+  }
+  if (d->pool_len + n > d->pool_cap) {
+    d->pool_cap = IMAX(d->pool_cap * 2, d->pool_len + n);
+    d->pool = realloc(d->pool, sizeof(int) * d->pool_cap);
+  }
+  int s = d->count++;
+  memcpy(&d->pool[d->pool_len], d->list, sizeof(int) * n);
+  d->set_at[s] = d->pool_len;
+  d->set_len[s] = n;
+  d->pool_len += n;
+  memset(&d->trans[s * 256], -1, sizeof(int) * 256);
+  d->hash[h] = s;
+
+  unsigned char accept = 0;
+  if (n == 0)
+    accept |= DFA_DEAD;
+  if (regex_list_has_match(d, d->list, n)) {
+    accept |= DFA_MATCH | DFA_MATCH_EDGE;
+  } else {
+    // d->list is stored, the stack can take the edge closure
+    int *edge = malloc(sizeof(int) * d->nfa_count);
+    int m = 0;
+    d->gen++;
+    for (int i = 0; i < n; i++) {
+      if (d->nfa[d->list[i]].type == d->edge)
+        regex_closure(d, edge, &m, d->nfa[d->list[i]].out);
+    }
+    regex_closure_assert(d, edge, &m, d->edge);
+    if (regex_list_has_match(d, edge, m))
+      accept |= DFA_MATCH_EDGE;
+    free(edge);
+  }
+  d->accept[s] = accept;
+  return s;
+}
+
+// intern d->list[0, n), emptying the cache first when it is full
+static int regex_dfa_add(regex_dfa *d, int n) {
+  int s = regex_dfa_intern(d, n);
+  if (s == -1) {
+    regex_dfa_flush(d);
+    s = regex_dfa_intern(d, n);
+  }
+  return s;
+}
+
+static int regex_dfa_start(regex_dfa *d, int begin) {
+  if (d->start[begin] != -1)
+    return d->start[begin];
+  int n = 0;
+  d->gen++;
+  regex_closure(d, d->list, &n, d->nfa_start);
+  if (begin)
+    regex_closure_assert(d, d->list, &n, d->begin);
+  int s = regex_dfa_add(d, n);
+  d->start[begin] = s;
+  return s;
+}
+
+static int regex_dfa_step_slow(regex_dfa *d, int from, unsigned char c) {
+  int n = 0;
+  d->gen++;
+  int *set = &d->pool[d->set_at[from]];
+  for (int i = 0; i < d->set_len[from]; i++) {
+    regex_nfa_state *st = &d->nfa[set[i]];
+    if (st->type == NFA_BYTE && regex_set_has(d->sets[st->set], c))
+      regex_closure(d, d->list, &n, st->out);
+  }
+  if (d->unanchored)
+    regex_closure(d, d->list, &n, d->nfa_start);
+  int s = regex_dfa_intern(d, n);
+  if (s == -1) {
+    // from goes away with the cache, the caller moves on to s anyway
+    regex_dfa_flush(d);
+    return regex_dfa_intern(d, n);
+  }
+  d->trans[from * 256 + c] = s;
+  return s;
+}
+
+static inline int regex_dfa_step(regex_dfa *d, int from, unsigned char c) {
+  int s = d->trans[from * 256 + c];
+  return s != -1 ? s : regex_dfa_step_slow(d, from, c);
+}
+
+static inline unsigned char regex_row_byte(editor_row *row, int i) {
+  return i < row->gap_at ? row->chars[i] : row->chars[i + row->gap_len];
+}
+
+// the byte a set stands for alone, lower case when folded, -1 if not one
+static int regex_set_byte(editor_regex *re, int set) {
+  int byte = -1;
+  for (int c = 0; c < 256; c++) {
+    if (!regex_set_has(re->sets[set], c))
+      continue;
+    if (re->ignore_case && isupper(c) &&
+        regex_set_has(re->sets[set], tolower(c)))
+      continue;
+    if (byte != -1)
+      return -1;
+    byte = c;
+  }
+  return byte;
+}
+
+// the concatenated nodes from node on, in order
+static void regex_flatten(editor_regex *re, int node, int *out, int *n) {
+  if (re->nodes[node].type == REGEX_CAT) {
+    regex_flatten(re, re->nodes[node].a, out, n);
+    regex_flatten(re, re->nodes[node].b, out, n);
+  } else {
+    out[(*n)++] = node;
+  }
+}
+
+// longest run of bytes that has to follow each other in every match
+static char *regex_required_literal(editor_regex *re, int root) {
+  int *parts = malloc(sizeof(int) * re->node_count);
+  int n = 0;
+  regex_flatten(re, root, parts, &n);
+
+  char *best = calloc(n + 1, 1), *run = calloc(n + 1, 1);
+  int best_len = 0, run_len = 0;
+  for (int i = 0; i <= n; i++) {
+    int byte = -1, ends = 1;
+    if (i < n) {
+      regex_node *part = &re->nodes[parts[i]];
+      if (part->type == REGEX_CLASS) {
+        byte = regex_set_byte(re, part->set);
+        ends = 0;
+      } else if (part->type == REGEX_REPEAT && part->min > 0 &&
+                 re->nodes[part->a].type == REGEX_CLASS) {
+        // at least one, what follows may be one more
+        byte = regex_set_byte(re, re->nodes[part->a].set);
+      }
+    }
+    if (byte > 0 && byte != '\n')
+      run[run_len++] = byte;
+    else
+      ends = 1;
+    if (ends) {
+      if (run_len > best_len) {
+        memcpy(best, run, run_len);
+        best_len = run_len;
+        best[best_len] = '\0';
+      }
+      run_len = 0;
+    }
+  }
+  free(run);
+  free(parts);
+  if (best_len == 0) {
+    free(best);
+    return NULL;
+  }
+  return best;
+}
+
+// Compile pattern, NULL with *error set when it is not valid.
+editor_regex *editor_regex_compile(const char *pattern, int ignore_case,
+                                   const char **error) {
+  editor_regex *re = calloc(1, sizeof(editor_regex));
+  re->ignore_case = ignore_case;
+  regex_parser ps = {re, pattern, NULL};
+  int root = regex_parse_alt(&ps);
+  if (root != -1 && *ps.p != '\0') {
+    ps.error = "unmatched )";
+    root = -1;
+  }
+  if (root != -1) {
+    if (regex_dfa_init(re, &re->forward, root, 0) == -1 ||
+        regex_dfa_init(re, &re->reverse, root, 1) == -1) {
+      ps.error = "pattern too big";
+      root = -1;
+    }
+  }
+  if (root == -1) {
+    *error = ps.error;
+    editor_regex_free(re);
+    return NULL;
+  }
+  re->literal = regex_required_literal(re, root);
+  return re;
+}
+
+void editor_regex_free(editor_regex *re) {
+  if (re == NULL)
+    return;
+  regex_dfa_free(&re->forward);
+  regex_dfa_free(&re->reverse);
+  free(re->sets);
+  free(re->nodes);
+  free(re->literal);
+  free(re->starts);
+  free(re);
+}
+
+// bytes every match holds, NULL if none are known
+const char *editor_regex_literal(editor_regex *re) { return re->literal; }
+
+// mark where matches start in row, running the reversed pattern from its end
+static void regex_scan_starts(editor_regex *re, editor_row *row) {
+  regex_dfa *d = &re->reverse;
+  if (row->size + 1 > re->start_cap) {
+    re->start_cap = IMAX(re->start_cap * 2, row->size + 1);
+    re->starts = realloc(re->starts, sizeof(int) * re->start_cap);
+  }
+  // filled from the end so the offsets come out ascending
+  int *end = re->starts + re->start_cap;
+  int *p = end;
+
+  int s = regex_dfa_start(d, 1);
+  if (d->accept[s] & (row->size == 0 ? DFA_MATCH_EDGE : DFA_MATCH))
+    *--p = row->size;
+  for (int i = row->size - 1; i >= 0; i--) {
+    s = regex_dfa_step(d, s, regex_row_byte(row, i));
+    if (d->accept[s] & (i == 0 ? DFA_MATCH_EDGE : DFA_MATCH))
+      *--p = i;
+  }
+
+  re->start_count = end - p;
+  memmove(re->starts, p, sizeof(int) * re->start_count);
+  re->row = row;
+}
+
+// end of the longest match starting at from, -1 if there is none
+static int regex_longest(editor_regex *re, editor_row *row, int from) {
+  regex_dfa *d = &re->forward;
+  int s = regex_dfa_start(d, from == 0);
+  int end = -1;
+  if (d->accept[s] & (from == row->size ? DFA_MATCH_EDGE : DFA_MATCH))
+    end = from;
+  for (int i = from; i < row->size && !(d->accept[s] & DFA_DEAD); i++) {
+    s = regex_dfa_step(d, s, regex_row_byte(row, i));
+    if (d->accept[s] & (i + 1 == row->size ? DFA_MATCH_EDGE : DFA_MATCH))
+      end = i + 1;
+  }
+  return end;
+}
+
+// Offset of the first match at or after from in row, -1 if none, *len is its
+// length. The matches of a row are meant to be walked in order from 0, any
+// call but the first reuses the scan of the row made for from 0.
+int editor_regex_row_search(editor_regex *re, editor_row *row, int from,
+                            int *len) {
+  if (from == 0 || re->row != row)
+    regex_scan_starts(re, row);
+
+  int lo = 0, hi = re->start_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (re->starts[mid] < from)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < re->start_count; lo++) {
+    int at = re->starts[lo];
+    int end = regex_longest(re, row, at);
+    // empty matches are left out
+    if (end > at) {
+      *len = end - at;
+      return at;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,338 @@
+#include "editor.h"
+
+// Rows live in fixed size blocks, the blocks are the nodes of a treap
+// ordered by position in the file. Every node knows how many rows its
+// subtree holds so lookup, insert and delete are all O(log n) and the
+// index of a row is derived by walking up from its block.
+
+static unsigned int row_tree_seed = 0x9e3779b9;
+
+static unsigned int row_tree_random() {
+  // xorshift32
+  row_tree_seed ^= row_tree_seed << 13;
+  row_tree_seed ^= row_tree_seed >> 17;
+  row_tree_seed ^= row_tree_seed << 5;
+  return row_tree_seed;
+}
+
+static editor_row_block *row_block_new(unsigned int priority) {
+  editor_row_block *b = malloc(sizeof(editor_row_block));
+  b->left = NULL;
+  b->right = NULL;
+  b->parent = NULL;
+  b->priority = priority;
+  b->count = 0;
+  b->total = 0;
+  return b;
+}
+
+// rows [from, from + n) of b were moved there, point them and their render
+// at where they are now
+static void row_block_adopt(editor_row_block *b, int from, int n) {
+  for (int i = from; i < from + n; i++) {
+    b->rows[i].block = b;
+    if (b->rows[i].render != NULL)
+      b->rows[i].render->row = &b->rows[i];
+  }
+}
+
+static void row_block_update(editor_row_block *b) {
+  b->total = b->count;
+  if (b->left) {
+    b->total += b->left->total;
+    b->left->parent = b;
+  }
+  if (b->right) {
+    b->total += b->right->total;
+    b->right->parent = b;
+  }
+}
+
+static editor_row_block *row_block_merge(editor_row_block *a,
+                                         editor_row_block *b) {
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->priority > b->priority) {
+    a->right = row_block_merge(a->right, b);
+    row_block_update(a);
+    return a;
+  }
+  b->left = row_block_merge(a, b->left);
+  row_block_update(b);
+  return b;
+}
+
+// split so that the first k rows end up in *l, k must fall on a block edge
+static void row_block_split(editor_row_block *t, int k, editor_row_block **l,
+                            editor_row_block **r) {
+  if (t == NULL) {
+    *l = NULL;
+    *r = NULL;
+    return;
+  }
+  int left_total = t->left ? t->left->total : 0;
+  if (left_total + t->count <= k) {
+    row_block_split(t->right, k - left_total - t->count, &t->right, r);
+    row_block_update(t);
+    *l = t;
+  } else {
+    row_block_split(t->left, k, l, &t->left);
+    row_block_update(t);
+    *r = t;
+  }
+}
+
+// adjust subtree totals from b up to the root
+static void row_block_add_total(editor_row_block *b, int delta) {
+  for (; b != NULL; b = b->parent)
+    b->total += delta;
+}
+
+// index of the first row of block b
+static int row_block_rank(editor_row_block *b) {
+  int rank = b->left ? b->left->total : 0;
+  for (; b->parent != NULL; b = b->parent) {
+    editor_row_block *p = b->parent;
+    if (p->right == b)
+      rank += (p->left ? p->left->total : 0) + p->count;
+  }
+  return rank;
+}
+
+static void row_block_insert_after(editor_row_block **root,
+                                   editor_row_block *b, editor_row_block *nb) {
+  editor_row_block *l, *r;
+  row_block_split(*root, row_block_rank(b) + b->count, &l, &r);
+  *root = row_block_merge(row_block_merge(l, nb), r);
+  (*root)->parent = NULL;
+}
+
+static void row_block_remove(editor_row_block **root, editor_row_block *b) {
+  editor_row_block *p = b->parent;
+  editor_row_block *merged = row_block_merge(b->left, b->right);
+  if (merged)
+    merged->parent = p;
+  if (p == NULL)
+    *root = merged;
+  else if (p->left == b)
+    p->left = merged;
+  else
+    p->right = merged;
+  for (; p != NULL; p = p->parent)
+    row_block_update(p);
+  free(b);
+}
+
+static editor_row_block *row_block_first(editor_row_block *b) {
+  while (b != NULL && b->left != NULL)
+    b = b->left;
+  return b;
+}
+
+static editor_row_block *row_block_last(editor_row_block *b) {
+  while (b != NULL && b->right != NULL)
+    b = b->right;
+  return b;
+}
+
+// find the block holding row at, *offset is its position in the block
+static editor_row_block *row_block_find(editor_row_block *b, int at,
+                                        int *offset) {
+  *offset = 0;
+  while (b != NULL) {
+    int left_total = b->left ? b->left->total : 0;
+    if (at < left_total) {
+      b = b->left;
+    } else if (at < left_total + b->count) {
+      *offset = at - left_total;
+      return b;
+    } else {
+      at -= left_total + b->count;
+      b = b->right;
+    }
+  }
+  return NULL;
+}
+
+editor_row *editor_row_tree_get(editor_row_block *root, int at) {
+  if (root == NULL || at < 0 || at >= root->total)
+    return NULL;
+  int offset;
+  editor_row_block *b = row_block_find(root, at, &offset);
+  return &b->rows[offset];
+}
+
+int editor_row_tree_index(editor_row *row) {
+  editor_row_block *b = row->block;
+  return row_block_rank(b) + (row - b->rows);
+}
+
+editor_row *editor_row_tree_next(editor_row *row) {
+  editor_row_block *b = row->block;
+  if (row - b->rows + 1 < b->count)
+    return row + 1;
+  if (b->right != NULL) {
+    b = row_block_first(b->right);
+  } else {
+    while (b->parent != NULL && b->parent->right == b)
+      b = b->parent;
+    b = b->parent;
+  }
+  return b ? &b->rows[0] : NULL;
+}
+
+editor_row *editor_row_tree_prev(editor_row *row) {
+  editor_row_block *b = row->block;
+  if (row > b->rows)
+    return row - 1;
+  if (b->left != NULL) {
+    b = row_block_last(b->left);
+  } else {
+    while (b->parent != NULL && b->parent->left == b)
+      b = b->parent;
+    b = b->parent;
+  }
+  return b ? &b->rows[b->count - 1] : NULL;
+}
+
+editor_row *editor_row_tree_insert(editor_row_block **root, int at) {
+  int total = *root ? (*root)->total : 0;
+  if (at < 0 || at > total)
+    return NULL;
+
+  if (*root == NULL)
+    *root = row_block_new(row_tree_random());
+
+  int offset;
+  editor_row_block *b;
+  if (at == total) {
+    b = row_block_last(*root);
+    offset = b->count;
+  } else {
+    b = row_block_find(*root, at, &offset);
+  }
+
+  // full block, move its upper half to a new block right after it
+  if (b->count == ROW_BLOCK_SIZE) {
+    int half = ROW_BLOCK_SIZE / 2;
+    int moved = b->count - half;
+    editor_row_block *nb = row_block_new(row_tree_random());
+    memcpy(nb->rows, &b->rows[half], sizeof(editor_row) * moved);
+    row_block_adopt(nb, 0, moved);
+    nb->count = moved;
+    nb->total = moved;
+    b->count = half;
+    row_block_add_total(b, -moved);
+    row_block_insert_after(root, b, nb);
+    if (offset > half) {
+      b = nb;
+      offset -= half;
+    }
+  }
+
+  memmove(&b->rows[offset + 1], &b->rows[offset],
+          sizeof(editor_row) * (b->count - offset));
+  b->count++;
+  row_block_add_total(b, 1);
+  row_block_adopt(b, offset + 1, b->count - offset - 1);
+  b->rows[offset].block = b;
+  return &b->rows[offset];
+}
+
+// Insert count rows before row at in one go, at the cost of a single insert.
+// Returns the first of them, they are contiguous blocks in order.
+editor_row *editor_row_tree_insert_rows(editor_row_block **root, int at,
+                                        int count) {
+  int total = *root ? (*root)->total : 0;
+  if (at < 0 || at > total || count <= 0)
+    return NULL;
+
+  // the new blocks go in between two blocks, split the one at falls in
+  int offset;
+  editor_row_block *b = at < total ? row_block_find(*root, at, &offset) : NULL;
+  if (b != NULL && offset > 0) {
+    int moved = b->count - offset;
+    editor_row_block *nb = row_block_new(row_tree_random());
+    memcpy(nb->rows, &b->rows[offset], sizeof(editor_row) * moved);
+    row_block_adopt(nb, 0, moved);
+    nb->count = moved;
+    nb->total = moved;
+    b->count = offset;
+    row_block_add_total(b, -moved);
+    row_block_insert_after(root, b, nb);
+  }
+
+  // random priorities like any inserted block, so the treap stays balanced
+  editor_row_block *rows = NULL;
+  for (int done = 0; done < count; done += ROW_BLOCK_SIZE) {
+    editor_row_block *nb = row_block_new(row_tree_random());
+    nb->count = IMIN(ROW_BLOCK_SIZE, count - done);
+    nb->total = nb->count;
+    for (int i = 0; i < nb->count; i++)
+      nb->rows[i].block = nb;
+    rows = row_block_merge(rows, nb);
+  }
+
+  editor_row_block *l, *r;
+  row_block_split(*root, at, &l, &r);
+  *root = row_block_merge(row_block_merge(l, rows), r);
+  (*root)->parent = NULL;
+  return editor_row_tree_get(*root, at);
+}
+
+void editor_row_tree_delete(editor_row_block **root, int at) {
+  int offset;
+  editor_row_block *b = row_block_find(*root, at, &offset);
+  if (b == NULL)
+    return;
+  memmove(&b->rows[offset], &b->rows[offset + 1],
+          sizeof(editor_row) * (b->count - offset - 1));
+  b->count--;
+  row_block_add_total(b, -1);
+  row_block_adopt(b, offset, b->count - offset);
+  if (b->count == 0)
+    row_block_remove(root, b);
+}
+
+static editor_row_block *row_block_build(editor_row_block **blocks, int n,
+                                         int depth) {
+  if (n == 0)
+    return NULL;
+  int mid = n / 2;
+  editor_row_block *b = blocks[mid];
+  // keep the heap order of a treap: deeper nodes get lower priorities
+  b->priority = ((unsigned int)(63 - depth) << 26) |
+                (row_tree_random() & ((1u << 26) - 1));
+  b->left = row_block_build(blocks, mid, depth + 1);
+  b->right = row_block_build(blocks + mid + 1, n - mid - 1, depth + 1);
+  row_block_update(b);
+  return b;
+}
+
+editor_row_block *editor_row_tree_build(int numrows) {
+  if (numrows <= 0)
+    return NULL;
+  int nblocks = (numrows + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE;
+  editor_row_block **blocks = malloc(sizeof(editor_row_block *) * nblocks);
+  for (int i = 0; i < nblocks; i++) {
+    editor_row_block *b = row_block_new(0);
+    b->count = IMIN(ROW_BLOCK_SIZE, numrows - i * ROW_BLOCK_SIZE);
+    for (int j = 0; j < b->count; j++)
+      b->rows[j].block = b;
+    blocks[i] = b;
+  }
+  editor_row_block *root = row_block_build(blocks, nblocks, 0);
+  root->parent = NULL;
+  free(blocks);
+  return root;
+}
+
+void editor_row_tree_free(editor_row_block *root) {
+  if (root == NULL)
+    return;
+  editor_row_tree_free(root->left);
+  editor_row_tree_free(root->right);
+  free(root);
+}
@@ -0,0 +1,200 @@
+#include "editor.h"
+#include <pthread.h>
+
+// Saving in the background.
+// The main thread lists the text as pieces of a store snapshot, a worker
+// writes them to a temporary file next to the target, syncs it and renames it
+// over the target. A save that fails or is interrupted leaves the file as it
+// was. Editing goes on meanwhile, the store copies a row before changing
+// bytes the snapshot still reads.
+
+// pieces per writev, IOV_MAX is at least 1024 on linux and macos
+#define SAVE_IOV_COUNT 1024
+// bytes per writev at most, so the progress moves through big pieces too
+#define SAVE_BATCH_BYTES (4 * 1024 * 1024)
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_t thread;
+  int threaded;
+  int running;
+
+  // set up before the worker starts, read only until it is done
+  char *filename;
+  // mode of the file when it is new, 0666 & ~umask
+  mode_t mode;
+  editor_text_store *ts;
+  struct iovec *pieces;
+  int count;
+  size_t total;
+
+  // shared under lock
+  size_t written;
+  int done;
+  // errno of the step that failed, 0 once saved
+  int error;
+} sv = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// write the pieces to fd, -1 on error
+static int save_write(int fd) {
+  struct iovec batch[SAVE_IOV_COUNT];
+  // piece to write next and how much of it is written already
+  int at = 0;
+  size_t skip = 0;
+
+  while (at < sv.count) {
+    int n = 0;
+    size_t bytes = 0;
+    for (int i = at; i < sv.count && n < SAVE_IOV_COUNT; i++) {
+      if (bytes == SAVE_BATCH_BYTES)
+        break;
+      size_t from = i == at ? skip : 0;
+      size_t len = sv.pieces[i].iov_len - from;
+      if (len > SAVE_BATCH_BYTES - bytes)
+        len = SAVE_BATCH_BYTES - bytes;
+      batch[n].iov_base = (char *)sv.pieces[i].iov_base + from;
+      batch[n].iov_len = len;
+      bytes += len;
+      n++;
+    }
+
+    ssize_t written = writev(fd, batch, n);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0) {
+      if (written == 0)
+        errno = EIO;
+      return -1;
+    }
+
+    // a short write carries on from where it stopped
+    size_t left = written;
+    while (left > 0) {
+      size_t rest = sv.pieces[at].iov_len - skip;
+      if (left < rest) {
+        skip += left;
+        break;
+      }
+      left -= rest;
+      at++;
+      skip = 0;
+    }
+
+    pthread_mutex_lock(&sv.lock);
+    sv.written += written;
+    pthread_mutex_unlock(&sv.lock);
+  }
+  return 0;
+}
+
+// fsync the directory holding path so a rename in it is on disk too
+static void save_sync_dir(const char *path, int dirlen) {
+  char *dir = dirlen > 0 ? strndup(path, dirlen) : strdup(".");
+  int fd = open(dir, O_RDONLY);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+  free(dir);
+}
+
+static void *save_worker(void *arg) {
+  (void)arg;
+  // through a symlink it is the file it points to that gets replaced
+  char *target = realpath(sv.filename, NULL);
+  const char *path = target != NULL ? target : sv.filename;
+  const char *slash = strrchr(path, '/');
+  int dirlen = slash != NULL ? slash - path + 1 : 0;
+  size_t tmpsize = strlen(path) + 16;
+  char *tmp = malloc(tmpsize);
+  snprintf(tmp, tmpsize, "%.*s.%s.XXXXXX", dirlen, path, path + dirlen);
+
+  int ok = 0;
+  int fd = mkstemp(tmp);
+  if (fd != -1) {
+    // the file keeps its owner and mode, a new one gets 0666 & ~umask
+    struct stat st;
+    if (stat(path, &st) == 0) {
+      fchown(fd, st.st_uid, st.st_gid);
+      fchmod(fd, st.st_mode & 07777);
+    } else {
+      fchmod(fd, sv.mode);
+    }
+    ok = save_write(fd) != -1 && fsync(fd) != -1;
+    if (close(fd) == -1)
+      ok = 0;
+    if (ok && rename(tmp, path) == -1)
+      ok = 0;
+    if (!ok) {
+      int saved = errno;
+      unlink(tmp);
+      errno = saved;
+    } else {
+      save_sync_dir(path, dirlen);
+    }
+  }
+  int error = ok ? 0 : errno;
+  free(tmp);
+  free(target);
+
+  pthread_mutex_lock(&sv.lock);
+  sv.error = error;
+  sv.done = 1;
+  pthread_mutex_unlock(&sv.lock);
+  return NULL;
+}
+
+// Start saving the rows from first on to filename, freezing ts until
+// editor_save_finish. Only one save runs at a time.
+void editor_save_start(const char *filename, editor_text_store *ts,
+                       editor_row *first) {
+  if (sv.running)
+    editor_save_finish();
+  sv.filename = strdup(filename);
+  // umask is for the whole process, it is only read and put back here while
+  // no worker runs
+  mode_t mask = umask(0);
+  umask(mask);
+  sv.mode = 0666 & ~mask;
+  sv.ts = ts;
+  sv.pieces = editor_text_store_snapshot(ts, first, &sv.count, &sv.total);
+  sv.written = 0;
+  sv.done = 0;
+  sv.error = 0;
+  sv.running = 1;
+  // saved on this thread when no worker can start
+  sv.threaded = pthread_create(&sv.thread, NULL, save_worker, NULL) == 0;
+  if (!sv.threaded)
+    save_worker(NULL);
+}
+
+int editor_save_running() { return sv.running; }
+
+// 1 while the worker is writing, with *written bytes of *total so far
+int editor_save_progress(size_t *written, size_t *total) {
+  pthread_mutex_lock(&sv.lock);
+  *written = sv.written;
+  int done = sv.done;
+  pthread_mutex_unlock(&sv.lock);
+  *total = sv.total;
+  return sv.running && !done;
+}
+
+// Wait for the save to end and release the snapshot. Returns the number of
+// bytes written, or -1 with errno set.
+long editor_save_finish() {
+  if (!sv.running)
+    return -1;
+  if (sv.threaded)
+    pthread_join(sv.thread, NULL);
+  editor_text_store_release(sv.ts, sv.pieces);
+  free(sv.filename);
+  sv.pieces = NULL;
+  sv.filename = NULL;
+  sv.running = 0;
+  if (sv.error != 0) {
+    errno = sv.error;
+    return -1;
+  }
+  return sv.total;
+}
@@ -0,0 +1,271 @@
+#include "editor.h"
+
+// Shadow model of the terminal screen.
+// A frame is drawn into back as cells of a character and its attributes,
+// front holds what the terminal shows. Flushing compares the two and only
+// sends the runs of cells that changed, moving the cursor over unchanged
+// stretches and sending SGR only when the attributes change, so the bytes
+// written follow what changed on screen rather than its size.
+//
+// A wide character takes two cells, the second one empty. Terminals do not
+// all agree on which characters are wide, a row holding any character past
+// ASCII is always sent whole, from its first column, so a disagreement does
+// not leave it garbled.
+//
+// When the view moves by a few rows the terminal scrolls what it shows
+// itself, inside a DECSTBM region, and front is shifted the same way so the
+// flush only draws the rows the scroll exposed.
+
+// unchanged cells written over rather than jumped, about what a move costs
+#define SCREEN_MOVE_COST 8
+
+static const editor_cell screen_blank = {" ", SCREEN_DEFAULT};
+
+static void screen_fill_blank(editor_cell *cells, int n) {
+  for (int i = 0; i < n; i++)
+    cells[i] = screen_blank;
+}
+
+void editor_screen_resize(editor_screen *s, int rows, int cols) {
+  if (rows == s->rows && cols == s->cols && s->back != NULL)
+    return;
+  s->rows = rows;
+  s->cols = cols;
+  s->back = realloc(s->back, sizeof(editor_cell) * rows * cols);
+  s->front = realloc(s->front, sizeof(editor_cell) * rows * cols);
+  editor_screen_invalidate(s);
+}
+
+// forget what the terminal shows, the next flush repaints everything
+void editor_screen_invalidate(editor_screen *s) { s->invalid = 1; }
+
+void editor_screen_free(editor_screen *s) {
+  free(s->back);
+  free(s->front);
+  s->back = NULL;
+  s->front = NULL;
+  s->rows = 0;
+  s->cols = 0;
+}
+
+// start a new frame, every cell blank
+void editor_screen_clear(editor_screen *s) {
+  screen_fill_blank(s->back, s->rows * s->cols);
+}
+
+static void screen_set_cell(editor_cell *cell, const char *text, int len,
+                            unsigned char attr) {
+  memset(cell->ch, 0, SCREEN_CELL_BYTES);
+  memcpy(cell->ch, text, len);
+  cell->attr = attr;
+}
+
+// bytes of text in cell
+static int screen_cell_len(const editor_cell *cell) {
+  int len = 0;
+  while (len < SCREEN_CELL_BYTES && cell->ch[len] != '\0')
+    len++;
+  return len;
+}
+
+// Draw len bytes of UTF-8 text at row y from column x on, clipped to the
+// screen. A combining mark goes in the cell before, with the character it
+// is on, a byte starting no valid sequence shows as '?'. Returns the column
+// after the text.
+int editor_screen_put(editor_screen *s, int y, int x, const char *text,
+                      int len, unsigned char attr) {
+  if (y < 0 || y >= s->rows)
+    return x;
+  editor_cell *row = &s->back[y * s->cols];
+  int i = 0;
+  while (i < len && x < s->cols) {
+    if ((unsigned char)text[i] < 0x80) {
+      screen_set_cell(&row[x++], &text[i++], 1, attr);
+      continue;
+    }
+    int cp;
+    int n = editor_utf8_decode(&text[i], len - i, &cp);
+    int width = editor_utf8_width(cp);
+    if (cp == -1) {
+      screen_set_cell(&row[x++], "?", 1, attr);
+    } else if (width == 0) {
+      // on the character before, when there is one and room in its cell
+      int at = x > 0 && row[x - 1].ch[0] == '\0' ? x - 2 : x - 1;
+      int used = at >= 0 ? screen_cell_len(&row[at]) : SCREEN_CELL_BYTES;
+      if (used + n <= SCREEN_CELL_BYTES)
+        memcpy(&row[at].ch[used], &text[i], n);
+    } else if (x + width > s->cols) {
+      // half a wide character does not fit
+      screen_set_cell(&row[x++], " ", 1, attr);
+    } else {
+      screen_set_cell(&row[x++], &text[i], n, attr);
+      if (width == 2)
+        screen_set_cell(&row[x++], "", 0, attr);
+    }
+    i += n;
+  }
+  return x;
+}
+
+static int screen_cell_equal(editor_cell a, editor_cell b) {
+  return !memcmp(a.ch, b.ch, SCREEN_CELL_BYTES) && a.attr == b.attr;
+}
+
+static int screen_has_multibyte(editor_cell *cells, int n) {
+  for (int i = 0; i < n; i++) {
+    // the second half of a wide character holds no byte
+    if ((unsigned char)cells[i].ch[0] >= 0x80 || cells[i].ch[0] == '\0')
+      return 1;
+  }
+  return 0;
+}
+
+static void screen_move(buffer *ab, int y, int x) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+  buffer_append(ab, buf, len);
+}
+
+static void screen_set_attr(buffer *ab, unsigned char attr) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "\x1b[0;%s%dm",
+                     attr & SCREEN_INVERSE ? "7;" : "",
+                     attr & ~SCREEN_INVERSE);
+  buffer_append(ab, buf, len);
+}
+
+// hide the cursor before the first change so it does not flicker across
+static void screen_hide_cursor(editor_screen *s, buffer *ab) {
+  if (!s->cursor_hidden)
+    buffer_append(ab, "\x1b[?25l", 6);
+  s->cursor_hidden = 1;
+}
+
+// Scroll rows [top, bottom) of the terminal by n rows, up when n > 0, and
+// shift front with them. Does nothing when the whole region would change.
+void editor_screen_scroll(editor_screen *s, buffer *ab, int top, int bottom,
+                          int n) {
+  int height = bottom - top;
+  int count = n > 0 ? n : -n;
+  if (s->invalid || n == 0 || count >= height)
+    return;
+  screen_hide_cursor(s, ab);
+  // scrolled in rows take the current background, reset it first
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), "\x1b[0m\x1b[%d;%dr\x1b[%d%c\x1b[r",
+                     top + 1, bottom, count, n > 0 ? 'S' : 'T');
+  buffer_append(ab, buf, len);
+
+  editor_cell *region = &s->front[top * s->cols];
+  size_t kept = sizeof(editor_cell) * (height - count) * s->cols;
+  if (n > 0) {
+    memmove(region, region + count * s->cols, kept);
+    screen_fill_blank(region + (height - count) * s->cols, count * s->cols);
+  } else {
+    memmove(region + count * s->cols, region, kept);
+    screen_fill_blank(region, count * s->cols);
+  }
+  // setting the region homes the cursor
+  s->cursor_y = -1;
+}
+
+// Append what turns front into back to ab, then put the cursor at y, x.
+// Returns 0 when the terminal already shows the frame.
+int editor_screen_flush(editor_screen *s, buffer *ab, int y, int x) {
+  // where the terminal cursor is, -1 once unknown
+  int cy = -1, cx = -1;
+  unsigned char attr = SCREEN_DEFAULT;
+
+  if (s->invalid) {
+    // a cleared terminal shows blank cells
+    screen_hide_cursor(s, ab);
+    buffer_append(ab, "\x1b[0m\x1b[2J", 8);
+    screen_fill_blank(s->front, s->rows * s->cols);
+    s->cursor_y = -1;
+    s->invalid = 0;
+  }
+
+  for (int row = 0; row < s->rows; row++) {
+    editor_cell *back = &s->back[row * s->cols];
+    editor_cell *front = &s->front[row * s->cols];
+    if (!memcmp(back, front, sizeof(editor_cell) * s->cols))
+      continue;
+    screen_hide_cursor(s, ab);
+
+    // columns are not cells past a multi-byte sequence, such a row is sent
+    // in one go from its start
+    int whole = screen_has_multibyte(back, s->cols) ||
+                screen_has_multibyte(front, s->cols);
+    int first = 0, end = s->cols;
+    if (!whole) {
+      while (screen_cell_equal(back[first], front[first]))
+        first++;
+      while (screen_cell_equal(back[end - 1], front[end - 1]))
+        end--;
+    }
+    // a blank tail is cleared with one sequence
+    int blank = s->cols;
+    while (blank > first && screen_cell_equal(back[blank - 1], screen_blank))
+      blank--;
+    if (blank < end && blank + 3 < s->cols)
+      end = blank;
+    else
+      blank = s->cols;
+
+    int i = first;
+    if (whole) {
+      screen_move(ab, row, 0);
+      cy = row;
+      cx = 0;
+    }
+    while (i < end) {
+      if (!whole && screen_cell_equal(back[i], front[i])) {
+        int next = i;
+        while (next < end && screen_cell_equal(back[next], front[next]))
+          next++;
+        if (next - i > SCREEN_MOVE_COST || next == end) {
+          i = next;
+          continue;
+        }
+      }
+      if (cy != row || cx != i) {
+        screen_move(ab, row, i);
+        cy = row;
+        cx = i;
+      }
+      if (back[i].attr != attr) {
+        screen_set_attr(ab, back[i].attr);
+        attr = back[i].attr;
+      }
+      buffer_append(ab, back[i].ch, screen_cell_len(&back[i]));
+      i++;
+      // the last column leaves the cursor waiting to wrap
+      cx = i == s->cols ? -1 : i;
+    }
+    if (blank < s->cols) {
+      if (cy != row || cx != blank)
+        screen_move(ab, row, blank);
+      if (attr != SCREEN_DEFAULT) {
+        buffer_append(ab, "\x1b[0m", 4);
+        attr = SCREEN_DEFAULT;
+      }
+      buffer_append(ab, "\x1b[K", 3);
+      cx = blank;
+    }
+    if (whole)
+      cy = -1;
+    memcpy(front, back, sizeof(editor_cell) * s->cols);
+  }
+
+  if (attr != SCREEN_DEFAULT)
+    buffer_append(ab, "\x1b[0m", 4);
+  if (!s->cursor_hidden && y == s->cursor_y && x == s->cursor_x)
+    return 0;
+  screen_move(ab, y, x);
+  s->cursor_y = y;
+  s->cursor_x = x;
+  if (s->cursor_hidden)
+    buffer_append(ab, "\x1b[?25h", 6);
+  s->cursor_hidden = 0;
+  return 1;
+}
@@ -0,0 +1,680 @@
+#include "editor.h"
+
+#include <limits.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SEARCH_AVX2
+#endif
+
+// Substring search over the text store.
+// Candidates are found a block at a time by comparing the first and the last
+// byte of the needle against the haystack at the matching distance, only
+// positions where both agree are compared in full. With AVX2 a block is 32
+// bytes, with SSE2 16, without either the first byte is found with memchr.
+// Ignoring case, both probe bytes are compared with bit 0x20 set when they
+// are letters, which folds ASCII case.
+
+static unsigned char search_fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+void editor_search_init(editor_search *s, const char *needle,
+                        int ignore_case) {
+  s->needle = needle;
+  s->len = str_len(needle);
+  s->ignore_case = ignore_case;
+  if (s->len == 0)
+    return;
+  unsigned char first = needle[0];
+  unsigned char last = needle[s->len - 1];
+  s->first_fold = ignore_case && isalpha(first) ? 0x20 : 0;
+  s->last_fold = ignore_case && isalpha(last) ? 0x20 : 0;
+  s->first = first | s->first_fold;
+  s->last = last | s->last_fold;
+}
+
+static int search_equal(editor_search *s, const char *p) {
+  if (!s->ignore_case)
+    return !memcmp(p, s->needle, s->len);
+  for (int i = 0; i < s->len; i++) {
+    if (search_fold(p[i]) != search_fold(s->needle[i]))
+      return 0;
+  }
+  return 1;
+}
+
+// candidates from i on, one byte at a time
+static long search_scalar(editor_search *s, const char *hay, size_t n,
+                          size_t i) {
+  size_t m = s->len;
+  if (!s->ignore_case || !s->first_fold) {
+    while (i + m <= n) {
+      const char *p = memchr(hay + i, s->needle[0], n - m + 1 - i);
+      if (p == NULL)
+        return -1;
+      i = p - hay;
+      if (search_equal(s, p))
+        return i;
+      i++;
+    }
+    return -1;
+  }
+  for (; i + m <= n; i++) {
+    if ((hay[i] | 0x20) == s->first && search_equal(s, hay + i))
+      return i;
+  }
+  return -1;
+}
+
+#ifdef SEARCH_AVX2
+__attribute__((target("avx2"))) static long
+search_avx2(editor_search *s, const char *hay, size_t n, size_t *next) {
+  size_t m = s->len;
+  const __m256i first = _mm256_set1_epi8(s->first);
+  const __m256i last = _mm256_set1_epi8(s->last);
+  const __m256i first_fold = _mm256_set1_epi8(s->first_fold);
+  const __m256i last_fold = _mm256_set1_epi8(s->last_fold);
+
+  size_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+    a = _mm256_or_si256(a, first_fold);
+    b = _mm256_or_si256(b, last_fold);
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (search_equal(s, hay + i + bit))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+  *next = i;
+  return -1;
+}
+#endif
+
+#ifdef __SSE2__
+static long search_sse2(editor_search *s, const char *hay, size_t n,
+                        size_t *next) {
+  size_t m = s->len;
+  const __m128i first = _mm_set1_epi8(s->first);
+  const __m128i last = _mm_set1_epi8(s->last);
+  const __m128i first_fold = _mm_set1_epi8(s->first_fold);
+  const __m128i last_fold = _mm_set1_epi8(s->last_fold);
+
+  size_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+    a = _mm_or_si128(a, first_fold);
+    b = _mm_or_si128(b, last_fold);
+    unsigned int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (search_equal(s, hay + i + bit))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+  *next = i;
+  return -1;
+}
+#endif
+
+long editor_search_buf(editor_search *s, const char *hay, size_t n) {
+  if (s->len == 0)
+    return 0;
+  if ((size_t)s->len > n)
+    return -1;
+
+  size_t next = 0;
+  long found = -1;
+#ifdef SEARCH_AVX2
+  static int avx2 = -1;
+  if (avx2 == -1)
+    avx2 = __builtin_cpu_supports("avx2");
+  if (avx2)
+    found = search_avx2(s, hay, n, &next);
+  else
+#endif
+#ifdef __SSE2__
+    found = search_sse2(s, hay, n, &next);
+#endif
+  if (found != -1)
+    return found;
+  return search_scalar(s, hay, n, next);
+}
+
+int editor_row_search(editor_search *s, editor_row *row, int from) {
+  if (from > row->size)
+    return -1;
+  if (row->gap_at >= row->size) {
+    long at = editor_search_buf(s, &row->chars[from], row->size - from);
+    return at != -1 ? from + at : -1;
+  }
+
+  // the row is left as is, a search may run next to the editor: matches
+  // before the gap, across it, then after it
+  int gap_at = row->gap_at;
+  if (from < gap_at) {
+    long at = editor_search_buf(s, &row->chars[from], gap_at - from);
+    if (at != -1)
+      return from + at;
+  }
+  if (s->len > 1) {
+    int lo = IMAX(from, gap_at - s->len + 1);
+    int hi = IMIN(gap_at + s->len - 1, row->size);
+    if (lo < hi) {
+      char *window = malloc(hi - lo);
+      editor_row_copy(row, lo, hi, window);
+      long at = editor_search_buf(s, window, hi - lo);
+      free(window);
+      if (at != -1)
+        return lo + at;
+    }
+  }
+  from = IMAX(from, gap_at);
+  long at = editor_search_buf(s, &row->chars[from + row->gap_len],
+                              row->size - from);
+  return at != -1 ? from + at : -1;
+}
+
+// 1 if the needle is in the row text at at
+int editor_row_match_at(editor_search *s, editor_row *row, int at) {
+  if (at < 0 || at + s->len > row->size)
+    return 0;
+  char buf[256];
+  char *text = s->len <= (int)sizeof(buf) ? buf : malloc(s->len);
+  editor_row_copy(row, at, at + s->len, text);
+  int match = search_equal(s, text);
+  if (text != buf)
+    free(text);
+  return match;
+}
+
+// Find the first of count rows from row on that holds the needle. Rows that
+// follow each other in the loaded file are searched as a single buffer: the
+// needle has no line break so a match never spans two rows.
+// Returns the row and sets *at to the match offset in it, NULL if none.
+editor_row *editor_search_rows(editor_search *s, editor_text_store *ts,
+                               editor_row *row, int count, int *at) {
+  while (row != NULL && count > 0) {
+    editor_row *last = row;
+    int rows = 1;
+    editor_row *next = editor_row_tree_next(last);
+    while (rows < count && next != NULL &&
+           editor_text_store_follows(ts, last, next)) {
+      last = next;
+      rows++;
+      next = editor_row_tree_next(last);
+    }
+
+    if (rows == 1) {
+      int found = editor_row_search(s, row, 0);
+      if (found != -1) {
+        *at = found;
+        return row;
+      }
+    } else {
+      const char *start = row->chars;
+      long found =
+          editor_search_buf(s, start, last->chars + last->size - start);
+      if (found != -1) {
+        const char *p = start + found;
+        while (p > row->chars + row->size)
+          row = editor_row_tree_next(row);
+        *at = p - row->chars;
+        return row;
+      }
+    }
+    row = next;
+    count -= rows;
+  }
+  return NULL;
+}
+
+// Match index of the search prompt.
+// A worker thread collects every match of the query in row order while the
+// prompt waits for keys, and writes to a pipe to wake it up as they come in.
+// When the query grows the matches of the shorter one are narrowed down
+// instead of scanning the rows again, the scan then goes on from where it
+// was. Rows do not change while the prompt is open, so the worker reads them
+// without locking. Matches and progress are shared under lock.
+
+// matches looked for in one go before checking for a cancel
+#define MATCH_SCAN_BYTES (1 << 20)
+// matches found before they are shared
+#define MATCH_BATCH 256
+#define MATCH_WAKE_INTERVAL 0.05
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t progress;
+  pthread_t thread;
+  int running;
+  int cancel;
+  int wake[2];
+
+  char *query;
+  // the needle, or the literal every match of the regex holds
+  editor_search search;
+  int regex;
+  editor_regex *re;
+  // why the regex did not compile
+  const char *error;
+  editor_text_store *ts;
+  editor_row_block *rows;
+  int numrows;
+
+  editor_match *matches;
+  int count;
+  int cap;
+  // every match in rows before it is in matches
+  int scanned;
+  int done;
+  int current;
+
+  // matches of the shorter query, narrowed by the worker
+  editor_match *narrow;
+  int narrow_count;
+  int narrow_scanned;
+} mi = {.lock = PTHREAD_MUTEX_INITIALIZER,
+        .progress = PTHREAD_COND_INITIALIZER,
+        .wake = {-1, -1}};
+
+static double match_index_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// wake the prompt up, the first matches at once then at most every
+// MATCH_WAKE_INTERVAL so it does not redraw for every batch
+static void match_index_wake(int now) {
+  static double last = 0;
+  double t = match_index_now();
+  if (!now && t - last < MATCH_WAKE_INTERVAL)
+    return;
+  last = t;
+  // full pipe means the prompt has a wake up pending already
+  if (write(mi.wake[1], "", 1) == -1) {
+  }
+}
+
+static void match_index_share(editor_match *batch, int n, int scanned) {
+  pthread_mutex_lock(&mi.lock);
+  int first = mi.count == 0 && n > 0;
+  if (mi.count + n > mi.cap) {
+    mi.cap = IMAX(mi.cap * 2, mi.count + n + MATCH_BATCH);
+    mi.matches = realloc(mi.matches, sizeof(editor_match) * mi.cap);
+  }
+  if (n > 0)
+    memcpy(&mi.matches[mi.count], batch, sizeof(editor_match) * n);
+  mi.count += n;
+  mi.scanned = scanned;
+  pthread_cond_broadcast(&mi.progress);
+  pthread_mutex_unlock(&mi.lock);
+  match_index_wake(first);
+}
+
+static int match_index_cancelled() {
+  pthread_mutex_lock(&mi.lock);
+  int cancel = mi.cancel;
+  pthread_mutex_unlock(&mi.lock);
+  return cancel;
+}
+
+// Rows following each other in the loaded file are scanned as one run of at
+// most MATCH_SCAN_BYTES. Sets the last row of the run starting at row and
+// how many rows it has, returns the row after it.
+static editor_row *match_index_run(editor_row *row, editor_row **last,
+                                   int *rows) {
+  *last = row;
+  *rows = 1;
+  size_t bytes = row->size;
+  editor_row *next = editor_row_tree_next(row);
+  while (next != NULL && bytes < MATCH_SCAN_BYTES &&
+         editor_text_store_follows(mi.ts, *last, next)) {
+    bytes += next->size + 1;
+    *last = next;
+    (*rows)++;
+    next = editor_row_tree_next(next);
+  }
+  return next;
+}
+
+// Scan the rows from at on for the needle. Returns 0 when cancelled.
+static int match_index_scan(editor_match *batch, int at) {
+  editor_search *s = &mi.search;
+  int n = 0;
+  editor_row *row = editor_row_tree_get(mi.rows, at);
+  while (row != NULL) {
+    editor_row *last;
+    int rows;
+    editor_row *next = match_index_run(row, &last, &rows);
+
+    int run_at = at;
+    const char *start = row->chars;
+    size_t len = last->chars + last->size - start;
+    size_t from = 0;
+    while (1) {
+      long found;
+      if (rows == 1) {
+        found = editor_row_search(s, row, from);
+      } else {
+        found = editor_search_buf(s, start + from, len - from);
+        if (found != -1)
+          found += from;
+      }
+      if (found == -1)
+        break;
+      // map the offset in the run back to its row
+      const char *p = start + found;
+      while (rows > 1 && p > row->chars + row->size) {
+        row = editor_row_tree_next(row);
+        at++;
+      }
+      if (n == MATCH_BATCH) {
+        match_index_share(batch, n, at);
+        n = 0;
+      }
+      batch[n].row = at;
+      batch[n].at = rows > 1 ? p - row->chars : found;
+      batch[n].len = s->len;
+      n++;
+      from = found + 1;
+    }
+    at = run_at + rows;
+
+    match_index_share(batch, n, at);
+    n = 0;
+    if (match_index_cancelled())
+      return 0;
+    row = next;
+  }
+  return 1;
+}
+
+// Scan every row for the regex. With a literal every match holds, only the
+// rows it is found in are run through the regex. Returns 0 when cancelled.
+static int match_index_scan_regex(editor_match *batch) {
+  editor_search *s = &mi.search;
+  int n = 0;
+  int at = 0;
+  editor_row *row = editor_row_tree_get(mi.rows, 0);
+  while (row != NULL) {
+    editor_row *last;
+    int rows;
+    editor_row *next = match_index_run(row, &last, &rows);
+
+    int run_at = at;
+    const char *start = row->chars;
+    size_t len = last->chars + last->size - start;
+    while (row != next) {
+      if (s->len > 0) {
+        // skip to the row the literal is next found in
+        size_t from = rows > 1 ? row->chars - start : 0;
+        long found;
+        if (rows == 1) {
+          found = editor_row_search(s, row, 0);
+        } else {
+          found = editor_search_buf(s, start + from, len - from);
+          if (found != -1)
+            found += from;
+        }
+        if (found == -1)
+          break;
+        const char *p = start + found;
+        while (rows > 1 && p > row->chars + row->size) {
+          row = editor_row_tree_next(row);
+          at++;
+        }
+      }
+
+      int from = 0, mlen;
+      while ((from = editor_regex_row_search(mi.re, row, from, &mlen)) != -1) {
+        if (n == MATCH_BATCH) {
+          match_index_share(batch, n, at);
+          n = 0;
+        }
+        batch[n].row = at;
+        batch[n].at = from;
+        batch[n].len = mlen;
+        n++;
+        from += mlen;
+      }
+      row = editor_row_tree_next(row);
+      at++;
+    }
+    at = run_at + rows;
+
+    match_index_share(batch, n, at);
+    n = 0;
+    if (match_index_cancelled())
+      return 0;
+    row = next;
+  }
+  return 1;
+}
+
+static void *match_index_worker(void *arg) {
+  (void)arg;
+  editor_search *s = &mi.search;
+  editor_match batch[MATCH_BATCH];
+  int n = 0;
+
+  // a longer query only matches where the shorter one did
+  for (int i = 0; i < mi.narrow_count; i++) {
+    editor_match m = mi.narrow[i];
+    if (n == MATCH_BATCH || (i % 4096 == 0 && i > 0)) {
+      match_index_share(batch, n, m.row);
+      n = 0;
+      if (match_index_cancelled())
+        return NULL;
+    }
+    editor_row *row = editor_row_tree_get(mi.rows, m.row);
+    m.len = s->len;
+    if (editor_row_match_at(s, row, m.at))
+      batch[n++] = m;
+  }
+  match_index_share(batch, n, mi.narrow_scanned);
+
+  int complete = mi.re != NULL ? match_index_scan_regex(batch)
+                               : match_index_scan(batch, mi.narrow_scanned);
+  if (!complete)
+    return NULL;
+
+  pthread_mutex_lock(&mi.lock);
+  mi.done = 1;
+  pthread_cond_broadcast(&mi.progress);
+  pthread_mutex_unlock(&mi.lock);
+  match_index_wake(1);
+  return NULL;
+}
+
+static void match_index_stop() {
+  if (mi.running) {
+    pthread_mutex_lock(&mi.lock);
+    mi.cancel = 1;
+    pthread_mutex_unlock(&mi.lock);
+    pthread_join(mi.thread, NULL);
+    mi.running = 0;
+    mi.cancel = 0;
+  }
+  free(mi.narrow);
+  mi.narrow = NULL;
+  editor_match_index_drain();
+}
+
+// Index the matches of query in rows, narrowing the current ones when query
+// extends the last one. A regex query never narrows, a longer pattern may
+// match more. Runs in the background until editor_match_index_clear.
+void editor_match_index_start(const char *query, int ignore_case, int regex,
+                              editor_text_store *ts, editor_row_block *rows,
+                              int numrows) {
+  match_index_stop();
+  if (mi.wake[0] == -1) {
+    if (pipe(mi.wake) == -1)
+      die("pipe");
+    fcntl(mi.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(mi.wake[1], F_SETFL, O_NONBLOCK);
+  }
+
+  int narrow = mi.query != NULL && mi.query[0] != '\0' && !regex &&
+               !mi.regex && mi.search.ignore_case == ignore_case &&
+               !strncmp(query, mi.query, strlen(mi.query));
+  if (narrow) {
+    mi.narrow = mi.matches;
+    mi.narrow_count = mi.count;
+    mi.narrow_scanned = mi.scanned;
+    // a cancelled scan may have listed part of the row it stopped in
+    while (mi.narrow_count > 0 &&
+           mi.narrow[mi.narrow_count - 1].row >= mi.narrow_scanned)
+      mi.narrow_count--;
+  } else {
+    free(mi.matches);
+    mi.narrow = NULL;
+    mi.narrow_count = 0;
+    mi.narrow_scanned = 0;
+  }
+  mi.matches = NULL;
+  mi.count = 0;
+  mi.cap = 0;
+  mi.scanned = 0;
+  mi.done = 0;
+  mi.current = -1;
+
+  free(mi.query);
+  mi.query = strdup(query);
+  editor_regex_free(mi.re);
+  mi.re = NULL;
+  mi.error = NULL;
+  mi.regex = regex;
+  if (regex && query[0] != '\0') {
+    mi.re = editor_regex_compile(query, ignore_case, &mi.error);
+    const char *literal = mi.re != NULL ? editor_regex_literal(mi.re) : NULL;
+    editor_search_init(&mi.search, literal != NULL ? literal : "", ignore_case);
+  } else {
+    editor_search_init(&mi.search, mi.query, ignore_case);
+  }
+  mi.ts = ts;
+  mi.rows = rows;
+  mi.numrows = numrows;
+
+  // an empty query matches nothing worth listing
+  if (mi.query[0] == '\0' || mi.error != NULL) {
+    mi.scanned = numrows;
+    mi.done = 1;
+    return;
+  }
+  mi.running = pthread_create(&mi.thread, NULL, match_index_worker, NULL) == 0;
+  if (!mi.running)
+    match_index_worker(NULL);
+}
+
+void editor_match_index_clear() {
+  match_index_stop();
+  free(mi.matches);
+  free(mi.query);
+  editor_regex_free(mi.re);
+  mi.matches = NULL;
+  mi.query = NULL;
+  mi.re = NULL;
+  mi.error = NULL;
+  mi.count = 0;
+  mi.cap = 0;
+  mi.scanned = 0;
+  mi.done = 0;
+  mi.current = -1;
+}
+
+// read end of the pipe the worker wakes the prompt up with, -1 if idle
+int editor_match_index_fd() {
+  return mi.query != NULL ? mi.wake[0] : -1;
+}
+
+void editor_match_index_drain() {
+  char buf[64];
+  while (mi.wake[0] != -1 && read(mi.wake[0], buf, sizeof(buf)) > 0)
+    ;
+}
+
+// Wait until the index holds more than n matches or is complete. Returns the
+// number of matches, -1 once the index is complete.
+static int match_index_wait(int n) {
+  pthread_mutex_lock(&mi.lock);
+  while (mi.count <= n && !mi.done && mi.running)
+    pthread_cond_wait(&mi.progress, &mi.lock);
+  int count = mi.count;
+  pthread_mutex_unlock(&mi.lock);
+  return count;
+}
+
+// Move to the next match in direction, waiting for the worker when it has not
+// got that far yet. Returns 0 when there is none.
+int editor_match_index_step(int direction, editor_match *m) {
+  int count;
+  if (direction > 0) {
+    count = match_index_wait(mi.current + 1);
+    if (count == 0)
+      return 0;
+    mi.current = mi.current + 1 < count ? mi.current + 1 : 0;
+  } else {
+    count = match_index_wait(INT_MAX);
+    if (count == 0)
+      return 0;
+    mi.current = mi.current > 0 ? mi.current - 1 : count - 1;
+  }
+  pthread_mutex_lock(&mi.lock);
+  *m = mi.matches[mi.current];
+  pthread_mutex_unlock(&mi.lock);
+  return 1;
+}
+
+// 1 while a search is shown, with the current match k of n so far
+int editor_match_index_status(int *k, int *n, int *done) {
+  if (mi.query == NULL || mi.query[0] == '\0' || mi.error != NULL)
+    return 0;
+  pthread_mutex_lock(&mi.lock);
+  *k = mi.current + 1;
+  *n = mi.count;
+  *done = mi.done;
+  pthread_mutex_unlock(&mi.lock);
+  return 1;
+}
+
+// Copy up to max matches of row into out, ordered by position. Returns how
+// many were copied.
+int editor_match_index_row(int row, editor_match *out, int max) {
+  if (mi.query == NULL)
+    return 0;
+  pthread_mutex_lock(&mi.lock);
+  int lo = 0, hi = mi.count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (mi.matches[mid].row < row)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  int n = 0;
+  while (lo + n < mi.count && n < max && mi.matches[lo + n].row == row) {
+    out[n] = mi.matches[lo + n];
+    n++;
+  }
+  pthread_mutex_unlock(&mi.lock);
+  return n;
+}
+
+// why the regex being searched for is not valid, NULL if it is
+const char *editor_match_index_error() {
+  return mi.query != NULL ? mi.error : NULL;
+}
@@ -0,0 +1,328 @@
+#include "editor.h"
+
+#include <dirent.h>
+
+// Syntax definitions, built in or loaded from *.syntax files, compiled once
+// at startup into a byte class table and a perfect hash of the keywords so
+// the lexer does a single table lookup per byte and per word.
+//
+// A definition file holds one directive per line, '#' starts a comment:
+//
+//   filetype c
+//   extensions .c .h
+//   comment //
+//   multiline-comment /* */
+//   highlight numbers strings comments
+//   keywords if while for return
+//   types int char void
+//
+// keywords and types may span several lines. Files are read from
+// $DICTEE_SYNTAX_DIR, or ~/.config/dictee/syntax when it is not set, and take
+// precedence over a built in definition with the same extension.
+
+char *C_HL_extensions[] = {".c", ".h", ".cpp", ".hpp", NULL};
+char *C_HL_keywords[] = {
+    "switch",  "if",    "while",    "for",     "break",   "continue",
+    "return",  "else",  "struct",   "union",   "typedef", "static",
+    "enum",    "class", "#include", "#define", "#endif",  "#if",
+    "#else",   "#elif", "#idef",    "#ifndef", "case",    "default",
+    "int|",    "long|", "double|",  "float|",  "char|",   "unsigned|",
+    "signed|", "void|", NULL};
+
+char *JS_HL_extensions[] = {".js", ".jsx", ".cjs", ".mjs", NULL};
+char *JS_HL_keywords[] = {"switch",   "if",      "while",   "for",     "break",
+                          "continue", "return",  "default", "import",  "export",
+                          "require",  "console", "else",    "static",  "const|",
+                          "class",    "case",    "let|",    "String|", "Array|",
+                          "Set|",     "Buffer|", NULL};
+
+// the compiled fields are filled in by editor_syntax_compile
+editor_syntax HLDB[] = {
+    {.filetype = "c",
+     .filematches = C_HL_extensions,
+     .single_line_comment_start = "//",
+     .multiline_comment_start = "/*",
+     .multiline_comment_end = "*/",
+     .keywords = C_HL_keywords,
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS |
+              HL_HIGHLIGHT_COMMENT},
+    {.filetype = "js",
+     .filematches = JS_HL_extensions,
+     .single_line_comment_start = "//",
+     .multiline_comment_start = "/*",
+     .multiline_comment_end = "*/",
+     .keywords = JS_HL_keywords,
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS |
+              HL_HIGHLIGHT_COMMENT},
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
+// definitions loaded from files
+static editor_syntax **syntax_loaded = NULL;
+static int syntax_loaded_count = 0;
+
+static unsigned int syntax_hash(unsigned int seed, const char *s, int len) {
+  // fnv-1a
+  unsigned int h = 2166136261u ^ seed;
+  for (int i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+// Place every keyword in a slot of its own: try seeds until no two keywords
+// collide, doubling the table when a size keeps failing.
+static void syntax_build_keyword_table(editor_syntax *s) {
+  int n = 0;
+  while (s->keywords && s->keywords[n])
+    n++;
+
+  unsigned int size = 8;
+  while (size < (unsigned int)n * 2)
+    size *= 2;
+
+  for (;;) {
+    editor_keyword *table = calloc(size, sizeof(editor_keyword));
+    for (unsigned int seed = 1; seed <= 256; seed++) {
+      int ok = 1;
+      for (int j = 0; j < n && ok; j++) {
+        int len = str_len(s->keywords[j]);
+        // kw2 are the ones that ends with |
+        int kw2 = s->keywords[j][len - 1] == '|';
+        if (kw2)
+          len--;
+        editor_keyword *k =
+            &table[syntax_hash(seed, s->keywords[j], len) & (size - 1)];
+        if (k->word != NULL) {
+          ok = k->len == len && !strncmp(k->word, s->keywords[j], len);
+          continue;
+        }
+        k->word = s->keywords[j];
+        k->len = len;
+        k->hl = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+      }
+      if (ok) {
+        s->keyword_table = table;
+        s->keyword_mask = size - 1;
+        s->keyword_seed = seed;
+        return;
+      }
+      memset(table, 0, size * sizeof(editor_keyword));
+    }
+    free(table);
+    size *= 2;
+  }
+}
+
+int editor_syntax_keyword(editor_syntax *s, const char *word, int len) {
+  if (len == 0 || s->keyword_table == NULL)
+    return HL_DEFAULT;
+  editor_keyword *k =
+      &s->keyword_table[syntax_hash(s->keyword_seed, word, len) &
+                        s->keyword_mask];
+  if (k->len == len && !memcmp(k->word, word, len))
+    return k->hl;
+  return HL_DEFAULT;
+}
+
+void editor_syntax_compile(editor_syntax *s) {
+  s->slc_len = str_len(s->single_line_comment_start);
+  s->mlcs_len = str_len(s->multiline_comment_start);
+  s->mlce_len = str_len(s->multiline_comment_end);
+  if (!(s->flags & HL_HIGHLIGHT_COMMENT)) {
+    s->slc_len = 0;
+    s->mlcs_len = 0;
+  }
+  // an unterminated block comment start is not a comment start
+  if (s->mlce_len == 0)
+    s->mlcs_len = 0;
+
+  for (int c = 0; c < 256; c++) {
+    unsigned char cls = 0;
+    if (c_is_separator(c))
+      cls |= CHAR_SEPARATOR;
+    if (isspace(c))
+      cls |= CHAR_SPACE;
+    if (isdigit(c))
+      cls |= CHAR_DIGIT;
+    if ((c == '"' || c == '\'') && (s->flags & HL_HIGHLIGHT_STRINGS))
+      cls |= CHAR_QUOTE;
+    if ((s->slc_len && c == (unsigned char)s->single_line_comment_start[0]) ||
+        (s->mlcs_len && c == (unsigned char)s->multiline_comment_start[0]))
+      cls |= CHAR_COMMENT;
+    if (!(cls & (CHAR_SEPARATOR | CHAR_QUOTE | CHAR_COMMENT)))
+      cls |= CHAR_WORD;
+    s->classes[c] = cls;
+  }
+
+  syntax_build_keyword_table(s);
+}
+
+static void syntax_free(editor_syntax *s) {
+  free(s->filetype);
+  for (int i = 0; s->filematches && s->filematches[i]; i++)
+    free(s->filematches[i]);
+  free(s->filematches);
+  for (int i = 0; s->keywords && s->keywords[i]; i++)
+    free(s->keywords[i]);
+  free(s->keywords);
+  free(s->single_line_comment_start);
+  free(s->multiline_comment_start);
+  free(s->multiline_comment_end);
+  free(s->keyword_table);
+  free(s);
+}
+
+// append the words of line to the NULL terminated list, suffix marks kw2
+static char **syntax_append_words(char **list, char *line, const char *suffix) {
+  int n = 0;
+  while (list && list[n])
+    n++;
+  for (char *w = strtok(line, " \t"); w; w = strtok(NULL, " \t")) {
+    list = realloc(list, sizeof(char *) * (n + 2));
+    list[n] = malloc(strlen(w) + strlen(suffix) + 1);
+    strcpy(list[n], w);
+    strcat(list[n], suffix);
+    list[++n] = NULL;
+  }
+  return list;
+}
+
+static char *syntax_next_word(char **line) {
+  char *w = strtok(*line, " \t");
+  *line = NULL;
+  return w ? strdup(w) : NULL;
+}
+
+// parse one definition file, NULL if it has no filetype or extensions
+static editor_syntax *syntax_load_file(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+    return NULL;
+
+  editor_syntax *s = calloc(1, sizeof(editor_syntax));
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  while ((len = getline(&line, &cap, fp)) != -1) {
+    while (len > 0 && isspace((unsigned char)line[len - 1]))
+      line[--len] = '\0';
+    char *p = line;
+    while (isspace((unsigned char)*p))
+      p++;
+    if (*p == '\0' || *p == '#')
+      continue;
+
+    char *key = p;
+    while (*p && !isspace((unsigned char)*p))
+      p++;
+    if (*p)
+      *p++ = '\0';
+
+    if (!strcmp(key, "filetype")) {
+      free(s->filetype);
+      s->filetype = syntax_next_word(&p);
+    } else if (!strcmp(key, "extensions")) {
+      s->filematches = syntax_append_words(s->filematches, p, "");
+    } else if (!strcmp(key, "comment")) {
+      free(s->single_line_comment_start);
+      s->single_line_comment_start = syntax_next_word(&p);
+    } else if (!strcmp(key, "multiline-comment")) {
+      free(s->multiline_comment_start);
+      free(s->multiline_comment_end);
+      s->multiline_comment_start = syntax_next_word(&p);
+      s->multiline_comment_end = syntax_next_word(&p);
+    } else if (!strcmp(key, "highlight")) {
+      for (char *w = strtok(p, " \t"); w; w = strtok(NULL, " \t")) {
+        if (!strcmp(w, "numbers"))
+          s->flags |= HL_HIGHLIGHT_NUMBERS;
+        else if (!strcmp(w, "strings"))
+          s->flags |= HL_HIGHLIGHT_STRINGS;
+        else if (!strcmp(w, "comments"))
+          s->flags |= HL_HIGHLIGHT_COMMENT;
+      }
+    } else if (!strcmp(key, "keywords")) {
+      s->keywords = syntax_append_words(s->keywords, p, "");
+    } else if (!strcmp(key, "types")) {
+      s->keywords = syntax_append_words(s->keywords, p, "|");
+    }
+  }
+  free(line);
+  fclose(fp);
+
+  if (s->filetype == NULL || s->filematches == NULL) {
+    syntax_free(s);
+    return NULL;
+  }
+  if (s->keywords == NULL)
+    s->keywords = calloc(1, sizeof(char *));
+  return s;
+}
+
+static void syntax_load_dir(const char *dir) {
+  DIR *d = opendir(dir);
+  if (d == NULL)
+    return;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    size_t len = strlen(e->d_name);
+    if (len < 7 || strcmp(e->d_name + len - 7, ".syntax"))
+      continue;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    editor_syntax *s = syntax_load_file(path);
+    if (s == NULL)
+      continue;
+    editor_syntax_compile(s);
+    syntax_loaded =
+        realloc(syntax_loaded,
+                sizeof(editor_syntax *) * (syntax_loaded_count + 1));
+    syntax_loaded[syntax_loaded_count++] = s;
+  }
+  closedir(d);
+}
+
+void editor_syntax_init() {
+  static int done = 0;
+  if (done)
+    return;
+  done = 1;
+
+  for (unsigned int i = 0; i < HLDB_ENTRIES; i++)
+    editor_syntax_compile(&HLDB[i]);
+
+  const char *dir = getenv("DICTEE_SYNTAX_DIR");
+  if (dir != NULL) {
+    syntax_load_dir(dir);
+  } else if (getenv("HOME") != NULL) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/.config/dictee/syntax", getenv("HOME"));
+    syntax_load_dir(path);
+  }
+}
+
+static int syntax_matches(editor_syntax *s, const char *filename) {
+  char *ext = strstr(filename, ".");
+  for (unsigned int j = 0; s->filematches[j]; j++) {
+    int is_ext = s->filematches[j][0] == '.';
+    if ((is_ext && ext && !strcmp(ext, s->filematches[j])) ||
+        (!is_ext && strstr(filename, s->filematches[j])))
+      return 1;
+  }
+  return 0;
+}
+
+editor_syntax *editor_syntax_for_file(const char *filename) {
+  editor_syntax_init();
+  for (int i = 0; i < syntax_loaded_count; i++) {
+    if (syntax_matches(syntax_loaded[i], filename))
+      return syntax_loaded[i];
+  }
+  for (unsigned int i = 0; i < HLDB_ENTRIES; i++) {
+    if (syntax_matches(&HLDB[i], filename))
+      return &HLDB[i];
+  }
+  return NULL;
+}
@@ -0,0 +1,278 @@
+#include "editor.h"
+
+// Piece table storage for row text.
+// The file as loaded stays untouched in orig, every edit goes to the end of
+// an append-only add buffer made of chunks that never move. Rows are views
+// (chars, size) into one of the two.
+//
+// A row living in the add buffer owns its bytes and keeps a gap at gap_at,
+// so typing at the same spot only writes into the gap. When the gap runs out
+// the row grows in place if it ends at the tail of the newest chunk, any other
+// row is copied to the tail with a fresh gap and its old bytes are simply left
+// behind. Rows in orig never have a gap.
+//
+// A snapshot taken for a save lists the pieces of text as they are and
+// freezes what the add buffer holds at that point. Until it is released a row
+// in frozen bytes is copied to the tail before anything changes it in place,
+// so the save reads the text as it was while editing goes on.
+
+#define ADD_CHUNK_SIZE (64 * 1024)
+
+static editor_add_chunk *text_store_new_chunk(editor_text_store *ts,
+                                              size_t min) {
+  size_t size = ADD_CHUNK_SIZE;
+  while (size < min)
+    size *= 2;
+  editor_add_chunk *c = malloc(sizeof(editor_add_chunk) + size);
+  c->next = ts->add;
+  c->size = size;
+  c->used = 0;
+  ts->add = c;
+  ts->add_size += size;
+  return c;
+}
+
+void editor_text_store_init(editor_text_store *ts, char *orig, size_t len) {
+  ts->orig = orig;
+  ts->orig_size = len;
+  ts->add = NULL;
+  ts->add_size = 0;
+  ts->frozen = 0;
+  ts->frozen_chunk = NULL;
+  ts->frozen_used = 0;
+}
+
+void editor_text_store_free(editor_text_store *ts) {
+  editor_add_chunk *c = ts->add;
+  while (c != NULL) {
+    editor_add_chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  free(ts->orig);
+  editor_text_store_init(ts, NULL, 0);
+}
+
+char *editor_text_store_append(editor_text_store *ts, const char *s,
+                               size_t len) {
+  editor_add_chunk *c = ts->add;
+  if (c == NULL || c->size - c->used < len)
+    c = text_store_new_chunk(ts, len);
+  char *p = c->data + c->used;
+  memcpy(p, s, len);
+  c->used += len;
+  return p;
+}
+
+static int text_store_in_orig(editor_text_store *ts, editor_row *row) {
+  return ts->orig != NULL && row->chars >= ts->orig &&
+         row->chars < ts->orig + ts->orig_size;
+}
+
+// 1 if row lives in add buffer bytes a snapshot still reads
+static int text_store_is_frozen(editor_text_store *ts, editor_row *row) {
+  if (!ts->frozen || text_store_in_orig(ts, row))
+    return 0;
+  // bytes in chunks newer than the snapshot are not
+  for (editor_add_chunk *c = ts->add; c != ts->frozen_chunk; c = c->next) {
+    if (row->chars >= c->data && row->chars < c->data + c->size)
+      return 0;
+  }
+  editor_add_chunk *c = ts->frozen_chunk;
+  return c == NULL || row->chars < c->data + ts->frozen_used ||
+         row->chars >= c->data + c->size;
+}
+
+static int text_store_is_tail(editor_text_store *ts, editor_row *row) {
+  editor_add_chunk *c = ts->add;
+  return c != NULL && c->used > 0 && row->chars >= c->data &&
+         row->chars + row->size + row->gap_len == c->data + c->used;
+}
+
+void editor_row_move_gap(editor_row *row, int at) {
+  if (row->gap_len > 0) {
+    if (at < row->gap_at)
+      memmove(&row->chars[at + row->gap_len], &row->chars[at],
+              row->gap_at - at);
+    else
+      memmove(&row->chars[row->gap_at], &row->chars[row->gap_at + row->gap_len],
+              at - row->gap_at);
+  }
+  row->gap_at = at;
+}
+
+// position of the first c at or after from in the row text, -1 if none
+int editor_row_find_char(editor_row *row, int from, char c) {
+  if (from < row->gap_at) {
+    char *p = memchr(&row->chars[from], c, row->gap_at - from);
+    if (p != NULL)
+      return p - row->chars;
+    from = row->gap_at;
+  }
+  // text after the gap is stored gap_len further
+  char *post = row->chars + row->gap_len;
+  char *p = memchr(&post[from], c, row->size - from);
+  return p != NULL ? p - post : -1;
+}
+
+// copy the row text [from, to) to dst
+void editor_row_copy(editor_row *row, int from, int to, char *dst) {
+  if (from < row->gap_at) {
+    int pre = IMIN(to, row->gap_at) - from;
+    memcpy(dst, &row->chars[from], pre);
+    dst += pre;
+    from += pre;
+  }
+  if (from < to)
+    memcpy(dst, &row->chars[from + row->gap_len], to - from);
+}
+
+void editor_text_store_reserve(editor_text_store *ts, editor_row *row,
+                               size_t extra) {
+  int frozen = text_store_is_frozen(ts, row);
+  if (!text_store_in_orig(ts, row) && !frozen && (size_t)row->gap_len >= extra)
+    return;
+
+  // grow the gap with the row so refilling it stays amortized O(1)
+  size_t grow = extra + row->size / 2 + 16;
+  int post = row->size - row->gap_at;
+  editor_add_chunk *c = ts->add;
+
+  if (!frozen && text_store_is_tail(ts, row) && c->size - c->used >= grow) {
+    memmove(&row->chars[row->gap_at + row->gap_len + grow],
+            &row->chars[row->gap_at + row->gap_len], post);
+    row->gap_len += grow;
+    c->used += grow;
+    return;
+  }
+
+  size_t need = row->size + grow;
+  if (c == NULL || c->size - c->used < need)
+    c = text_store_new_chunk(ts, need);
+  char *p = c->data + c->used;
+  memcpy(p, row->chars, row->gap_at);
+  memcpy(p + row->gap_at + grow, &row->chars[row->gap_at + row->gap_len], post);
+  row->chars = p;
+  row->gap_len = grow;
+  c->used += need;
+}
+
+// copy row to the tail when a snapshot still reads its bytes, before they
+// get moved or dropped in place
+void editor_text_store_thaw(editor_text_store *ts, editor_row *row) {
+  if (text_store_is_frozen(ts, row))
+    editor_text_store_reserve(ts, row, 0);
+}
+
+void editor_text_store_truncate(editor_text_store *ts, editor_row *row,
+                                int len) {
+  if (text_store_in_orig(ts, row)) {
+    row->size = len;
+    row->gap_at = len;
+    return;
+  }
+  editor_text_store_thaw(ts, row);
+  // the dropped tail becomes part of the gap
+  editor_row_move_gap(row, len);
+  row->gap_len += row->size - len;
+  row->size = len;
+}
+
+// length of the piece starting at row: the row itself plus its newline when
+// the original buffer already has it right after the row
+static size_t text_store_piece(editor_text_store *ts, editor_row *row) {
+  const char *end = row->chars + row->size;
+  if (text_store_in_orig(ts, row) && end < ts->orig + ts->orig_size &&
+      *end == '\n')
+    return row->size + 1;
+  return row->size;
+}
+
+// 1 if next starts right after the line break ending row in orig
+int editor_text_store_follows(editor_text_store *ts, editor_row *row,
+                              editor_row *next) {
+  if (!text_store_in_orig(ts, row) || !text_store_in_orig(ts, next))
+    return 0;
+  const char *end = row->chars + row->size;
+  if (next->chars <= end)
+    return 0;
+  // \r kept off the end of crlf lines
+  const char *p = end;
+  while (p < next->chars - 1 && *p == '\r')
+    p++;
+  return p == next->chars - 1 && *p == '\n';
+}
+
+typedef struct {
+  struct iovec *iov;
+  int count, cap;
+  size_t total;
+} text_store_pieces;
+
+static void text_store_emit(text_store_pieces *p, const char *s, size_t len) {
+  if (len == 0)
+    return;
+  if (p->count == p->cap) {
+    p->cap = p->cap ? p->cap * 2 : 256;
+    p->iov = realloc(p->iov, sizeof(struct iovec) * p->cap);
+  }
+  p->iov[p->count].iov_base = (void *)s;
+  p->iov[p->count].iov_len = len;
+  p->count++;
+  p->total += len;
+}
+
+// List the text of every row from first on, each followed by '\n', as pieces
+// pointing into the store, and freeze the store until
+// editor_text_store_release. Runs of untouched rows are still contiguous in
+// orig and make a single piece. Returns the pieces, *count of them holding
+// *total bytes.
+struct iovec *editor_text_store_snapshot(editor_text_store *ts,
+                                         editor_row *first, int *count,
+                                         size_t *total) {
+  text_store_pieces p = {NULL, 0, 0, 0};
+
+  editor_row *row = first;
+  while (row != NULL) {
+    if (row->gap_at < row->size) {
+      // gap in the middle, the row goes out as two pieces
+      int post = row->size - row->gap_at;
+      text_store_emit(&p, row->chars, row->gap_at);
+      text_store_emit(&p, &row->chars[row->gap_at + row->gap_len], post);
+      text_store_emit(&p, "\n", 1);
+      row = editor_row_tree_next(row);
+      continue;
+    }
+
+    const char *start = row->chars;
+    size_t len = text_store_piece(ts, row);
+    int has_newline = len > (size_t)row->size;
+    row = editor_row_tree_next(row);
+
+    // extend the piece while the next row follows it in the same buffer
+    while (has_newline && row != NULL && row->chars == start + len) {
+      size_t next = text_store_piece(ts, row);
+      has_newline = next > (size_t)row->size;
+      len += next;
+      row = editor_row_tree_next(row);
+    }
+
+    text_store_emit(&p, start, len);
+    if (!has_newline)
+      text_store_emit(&p, "\n", 1);
+  }
+
+  ts->frozen = 1;
+  ts->frozen_chunk = ts->add;
+  ts->frozen_used = ts->add != NULL ? ts->add->used : 0;
+  *count = p.count;
+  *total = p.total;
+  return p.iov;
+}
+
+// the snapshot is no longer read, rows get changed in place again
+void editor_text_store_release(editor_text_store *ts, struct iovec *pieces) {
+  ts->frozen = 0;
+  ts->frozen_chunk = NULL;
+  free(pieces);
+}